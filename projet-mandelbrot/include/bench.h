@@ -0,0 +1,24 @@
+
+#ifndef BENCH_IS_DEF
+#define BENCH_IS_DEF
+
+
+// Campagne de mesures en un seul processus (--bench v1,v2,...) : pour
+// chaque version et chaque nombre de threads, bench_warmup exécutions
+// d'échauffement puis bench_reps exécutions chronométrées de max_iter
+// itérations, chacune repartant de l'image et du cadre initiaux.
+// Les statistiques (médiane, min, moyenne, écart type, accélération par
+// rapport à seq) sont écrites en CSV, ou en JSON si le fichier de
+// sortie se termine par .json. seq et les versions sans OpenMP ni sched
+// (VERSION_SEQUENTIAL, VERSION_OPENCL) ne sont mesurées qu'une fois.
+
+void bench_run (const char *kernel);
+
+extern char *bench_versions;
+extern char *bench_threads;
+extern char *bench_output;
+extern unsigned bench_reps;
+extern unsigned bench_warmup;
+
+
+#endif
@@ -0,0 +1,24 @@
+
+#ifndef CHECK_IS_DEF
+#define CHECK_IS_DEF
+
+
+// Validation des versions d'un noyau (--check) : chaque version du
+// registre (ou <noyau>_compute_<v> de l'exécutable) calcule max_iter images
+// depuis l'état initial, image par image, dans un processus fils ; les
+// empreintes de chaque image (et de chacune de ses tuiles de
+// CHECK_TILE x CHECK_TILE pixels) sont comparées à celles de seq. Pour
+// une version qui diverge, on indique la première image et la première
+// tuile fautives, et le nombre de pixels différents. Les versions
+// VERSION_NO_CHECK (image volontairement différente) ne sont vérifiées
+// que si CHECK_VERSIONS les nomme.
+// Renvoie le nombre de versions en échec.
+
+#define CHECK_TILE 32
+
+int check_run (const char *kernel);
+
+extern unsigned do_check;
+
+
+#endif
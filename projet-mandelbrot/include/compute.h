@@ -5,10 +5,20 @@
 typedef void (*void_func_t) (void);
 typedef unsigned (*int_func_t) (unsigned);
 
+// Calcule la région [row, row+h[ x [col, col+w[ d'une image virtuelle de
+// taille dim x dim dans tile (pitch pixels par ligne)
+typedef void (*tile_func_t) (unsigned *tile, unsigned pitch,
+			     unsigned long row, unsigned long col,
+			     unsigned h, unsigned w, unsigned long dim);
+
 extern void_func_t the_first_touch;
 extern void_func_t the_init;
 extern void_func_t the_finalize;
 extern int_func_t the_compute;
+extern tile_func_t the_tile;
+
+// Résout les fonctions de la version courante du noyau (main.c)
+void bind_functions (void);
 
 extern unsigned opencl_used;
 extern char *version;
@@ -11,7 +11,11 @@
 //      'g' -- opérations graphiques
 //      's' -- scheduler
 //      'p' -- progression du calcul pas à pas
+//      't' -- durée des itérations, latence par image et par phase
 //      'o' -- OpenCL
+//      'h' -- compteurs matériels par thread (perf_event_open)
+//      'k' -- somme de contrôle des images relues sans affichage (OpenCL)
+//      'i' -- limite d'itérations choisie à chaque image (mandel, MANDEL_ITER)
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -0,0 +1,24 @@
+
+#ifndef FIRST_TOUCH_IS_DEF
+#define FIRST_TOUCH_IS_DEF
+
+
+// Placement mémoire par premier accès (-ft) : une page est allouée sur le
+// nœud NUMA du thread qui l'écrit en premier. Ces routines écrivent
+// image (et alt_image, index_image si elles existent) avec la même
+// répartition que la version qui les calculera ensuite ; elles ne servent
+// que si les threads sont fixés à leurs cœurs (OMP_PROC_BIND=true).
+
+// Tranches de lignes, schedule(static, chunk) : chunk = 0 pour des blocs
+// contigus (schedule(static)), 1 pour une distribution cyclique
+void first_touch_rows (unsigned chunk);
+
+// grain x grain tuiles (bornes i * DIM / grain), réparties par paquets de
+// chunk tuiles comme un collapse(2) schedule(static, chunk)
+void first_touch_tiles (unsigned grain, unsigned chunk);
+
+// Écrit la région [i_d, i_f] x [j_d, j_f] depuis le thread appelant
+void first_touch_region (int i_d, int j_d, int i_f, int j_f);
+
+
+#endif
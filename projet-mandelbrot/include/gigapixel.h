@@ -0,0 +1,19 @@
+
+#ifndef GIGAPIXEL_IS_DEF
+#define GIGAPIXEL_IS_DEF
+
+
+// Rendu "hors mémoire" d'images géantes (-g <fichier>) : l'image est
+// découpée en tuiles de GIGA_TILE x GIGA_TILE pixels stockées dans un
+// fichier projeté en mémoire, accompagnées d'une pyramide de niveaux
+// sous-échantillonnés. Un rendu interrompu reprend là où il s'était arrêté.
+
+#define GIGA_TILE        256
+#define GIGA_MAX_LEVELS  16
+
+void gigapixel_render (char *filename);
+
+extern char *gigapixel_file;
+
+
+#endif
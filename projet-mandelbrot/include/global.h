@@ -8,6 +8,8 @@ extern unsigned refresh_rate;
 extern int max_iter;
 extern unsigned do_first_touch;
 extern unsigned do_random;
+extern unsigned full_upload;
+extern unsigned indexed_display;
 extern char *pngfile;
 
 extern unsigned DIM;
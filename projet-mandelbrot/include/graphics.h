@@ -15,12 +15,45 @@ int graphics_display_enabled (void);
 
 extern Uint32 *image, *alt_image;
 
+// alt_image n'existe que pour les versions à double tampon
+// (VERSION_DOUBLE_BUFFER) : sans effet si elle est déjà allouée
+void graphics_alloc_alt_image (void);
+
+// Suivi des zones modifiées : un noyau qui positionne dirty_tracking
+// signale lui-même (graphics_mark_dirty) les pixels qu'il a changés depuis
+// le dernier rafraîchissement, et seules ces zones sont renvoyées à la
+// texture. Sinon, l'image entière est transférée à chaque fois.
+#define DIRTY_TILE 64
+
+extern unsigned dirty_tracking;
+extern unsigned dirty_ntiles;
+extern unsigned char *dirty_tiles;
+
+void graphics_mark_all_dirty (void);
+
+static inline void graphics_mark_dirty (int l, int c, int h, int w)
+{
+  for (int i = l / DIRTY_TILE; i <= (l + h - 1) / DIRTY_TILE; i++)
+    for (int j = c / DIRTY_TILE; j <= (c + w - 1) / DIRTY_TILE; j++)
+      __atomic_store_n (&dirty_tiles [i * dirty_ntiles + j], 1, __ATOMIC_RELAXED);
+}
+
+// Indexation 64 bits : l * DIM déborde d'un int dès que DIM > 46340
 static inline Uint32 *img_cell (Uint32 *i, int l, int c)
 {
-  return i + l * DIM + c;
+  return i + (size_t) l * DIM + c;
 }
 
+// Affichage indexé (-ix) : un noyau qui fournit une palette
+// (graphics_set_palette) écrit des indices 8 bits dans index_image au lieu
+// de couleurs RGBA dans image ; la couleur est appliquée à l'affichage.
+// index_image vaut NULL si l'affichage indexé n'est pas actif.
+extern Uint8 *index_image;
+
+void graphics_set_palette (Uint32 *colors, unsigned n);
+
 #define cur_img(y,x) (*img_cell(image,(y),(x)))
+#define cur_idx(y,x) (index_image [(size_t) (y) * DIM + (x)])
 #define next_img(y,x) (*img_cell(alt_image,(y),(x)))
 
 static inline void swap_images (void)
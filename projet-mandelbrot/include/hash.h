@@ -0,0 +1,32 @@
+
+#ifndef HASH_IS_DEF
+#define HASH_IS_DEF
+
+
+#include <stdint.h>
+#include <string.h>
+
+// FNV-1a 64 bits. Les appels se chaînent :
+//   h = hash_bytes (HASH_INIT, a, la); h = hash_bytes (h, b, lb); ...
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+static inline uint64_t hash_bytes (uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= p [i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Le '\0' final est inclus, pour que ("ab", "c") != ("a", "bc")
+static inline uint64_t hash_string (uint64_t h, const char *s)
+{
+  return hash_bytes (h, s, strlen (s) + 1);
+}
+
+
+#endif
@@ -0,0 +1,32 @@
+
+#ifndef HISTOGRAM_IS_DEF
+#define HISTOGRAM_IS_DEF
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Histogramme log-linéaire à la HDR : chaque puissance de deux est
+// découpée en HISTO_HALF cases, soit une erreur relative inférieure à
+// 1/HISTO_HALF (< 1 %) sur toute valeur de 0 à 2^64, en taille fixe.
+
+#define HISTO_SUB_BITS 8
+#define HISTO_HALF     (1U << (HISTO_SUB_BITS - 1))
+#define HISTO_BUCKETS  ((66 - HISTO_SUB_BITS) * HISTO_HALF)
+
+typedef struct {
+  uint64_t count;
+  uint64_t min, max;
+  double sum;
+  uint64_t bucket [HISTO_BUCKETS];
+} histogram_t;
+
+void histogram_reset (histogram_t *h);
+void histogram_record (histogram_t *h, uint64_t value);
+uint64_t histogram_percentile (histogram_t *h, double p);
+
+// Valeurs en ns, affichées en ms : n, moyenne, p50, p90, p99, p99.9, max
+void histogram_print (histogram_t *h, const char *name, FILE *f);
+
+
+#endif
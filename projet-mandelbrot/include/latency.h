@@ -0,0 +1,30 @@
+
+#ifndef LATENCY_IS_DEF
+#define LATENCY_IS_DEF
+
+
+#include <stdint.h>
+
+// Latence image par image (drapeau de debug 't'), par phase : calcul
+// (the_compute), mise en couleur et envoi de la texture, affichage, et
+// en mode interactif délai entre une action et son affichage. Les
+// durées sont rangées dans des histogrammes ; la première image de
+// chaque phase (échauffement) est mise à part. Le rapport donne
+// p50/p90/p99/p99.9/max en fin d'exécution.
+
+enum {
+  PHASE_COMPUTE,
+  PHASE_COLORIZE,
+  PHASE_DISPLAY,
+  PHASE_INPUT,     // action de l'utilisateur -> aperçu affiché (--interactive)
+  NB_PHASES
+};
+
+void latency_init (void);
+void latency_record (int phase, uint64_t ns);
+void latency_report (const char *kernel);
+
+extern unsigned latency_enabled;
+
+
+#endif
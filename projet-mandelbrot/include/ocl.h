@@ -18,6 +18,15 @@ void ocl_send_image (unsigned *image);
 unsigned ocl_compute (unsigned nb_iter);
 void ocl_wait (void);
 void ocl_update_texture (void);
+cl_kernel ocl_create_kernel (const char *name);
+void ocl_rebuild_program (void);
+size_t ocl_max_workgroup_size (void);
+
+void ocl_readback (void);
+void ocl_readback_flush (void);
+
+cl_event *ocl_event (const char *label);
+void ocl_profiling_report (void);
 
 #define check(err, ...)					\
   do {							\
@@ -28,9 +37,13 @@ void ocl_update_texture (void);
   } while (0)
 
 extern unsigned SIZE, TILE, TILEX, TILEY;
+extern cl_context context;
 extern cl_kernel compute_kernel;
 extern cl_command_queue queue;
 extern cl_mem cur_buffer, next_buffer;
+extern char *ocl_profile_file;
+extern unsigned ocl_pingpong;
+extern unsigned ocl_initialized;
 
 
 #endif
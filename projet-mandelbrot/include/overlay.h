@@ -0,0 +1,47 @@
+
+#ifndef OVERLAY_IS_DEF
+#define OVERLAY_IS_DEF
+
+
+#include <stdint.h>
+#include <SDL.h>
+
+#include "timing.h"
+
+// Surimpression des tuiles (touche 'o' en mode graphique) : coût de
+// calcul de chaque tuile (du bleu, la plus rapide, au rouge, la plus
+// lente) ou couleur du thread qui l'a calculée. L'image elle-même n'est
+// pas modifiée : les rectangles sont dessinés par-dessus la texture.
+//
+// Côté noyau, une version tuilée appelle overlay_begin (grain) avant
+// chaque lot, puis encadre chaque tuile par overlay_start et
+// overlay_record : sans surimpression, le coût est d'un test par tuile.
+
+enum {
+  OVERLAY_OFF,
+  OVERLAY_COST,
+  OVERLAY_WORKER,
+  OVERLAY_NB_MODES
+};
+
+extern unsigned overlay_mode;
+
+void overlay_next_mode (void);
+void overlay_begin (unsigned grain);
+void overlay_store (unsigned i, unsigned j, uint64_t start, unsigned worker);
+void overlay_draw (SDL_Renderer *ren, int width, int height);
+
+static inline uint64_t overlay_start (void)
+{
+  return overlay_mode != OVERLAY_OFF ? timing_stamp () : 0;
+}
+
+// Tuile (i, j) d'une grille grain x grain, aux bornes i * DIM / grain
+static inline void overlay_record (unsigned i, unsigned j, uint64_t start, unsigned worker)
+{
+  if (overlay_mode != OVERLAY_OFF)
+    overlay_store (i, j, start, worker);
+}
+
+
+#endif
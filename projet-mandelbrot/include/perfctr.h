@@ -0,0 +1,40 @@
+
+#ifndef PERFCTR_IS_DEF
+#define PERFCTR_IS_DEF
+
+
+// Compteurs matériels par thread (perf_event_open, Linux), activés par le
+// drapeau de debug 'h'. Chaque thread de calcul (threads OpenMP, ouvriers
+// de sched) ouvre ses propres compteurs ; perfctr_begin/perfctr_end
+// encadrent un appel à the_compute et, sous 'h', affichent les compteurs
+// de chaque thread et leur total. Un compteur que la machine ou le noyau
+// refuse (perf_event_paranoid, virtualisation...) est simplement ignoré.
+
+enum {
+  PERFCTR_CYCLES,
+  PERFCTR_INSTRUCTIONS,
+  PERFCTR_L1D_MISSES,
+  PERFCTR_LLC_MISSES,
+  PERFCTR_BRANCH_MISSES,
+  PERFCTR_STALLED_BACKEND,
+  PERFCTR_NB
+};
+
+extern const char *perfctr_name [PERFCTR_NB];
+
+void perfctr_init (void);
+void perfctr_register (const char *kind, int id);
+void perfctr_unregister (void);
+
+void perfctr_begin (void);
+void perfctr_end (unsigned frames);
+
+// Cumul des intervalles begin/end depuis le dernier perfctr_reset
+// (-1 : compteur indisponible)
+void perfctr_reset (void);
+void perfctr_totals (double total [PERFCTR_NB]);
+
+extern unsigned perfctr_enabled;
+
+
+#endif
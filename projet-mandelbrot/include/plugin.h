@@ -0,0 +1,18 @@
+
+#ifndef PLUGIN_IS_DEF
+#define PLUGIN_IS_DEF
+
+
+// Noyaux compilés à part (make plugins) pour plusieurs niveaux d'ISA :
+// PLUGIN_DIR/<kernel>.<isa>.so, PLUGIN_DIR valant plugins par défaut.
+// plugin_load charge le greffon du meilleur niveau que le processeur sait
+// exécuter ; ses versions remplacent dans le registre celles compilées
+// dans prog (niveau de base), qui restent utilisées sans greffon.
+// --isa <niveau> impose un niveau, --isa builtin les versions de prog.
+
+void plugin_load (void);
+
+extern char *plugin_isa; // niveau demandé (--isa), puis niveau chargé
+
+
+#endif
@@ -0,0 +1,55 @@
+
+#ifndef REGISTRY_IS_DEF
+#define REGISTRY_IS_DEF
+
+
+#include "compute.h"
+#include "tuning.h"
+#include "view.h"
+
+// Registre des noyaux : chaque noyau décrit ses versions (points d'entrée
+// et besoins) dans une table, enregistrée au lancement par
+// REGISTER_KERNEL. Le programme n'alloue alors que ce dont la version
+// choisie a besoin, et --bench / --check connaissent les versions
+// existantes. Un noyau absent du registre est encore cherché par dlsym
+// (<kernel>_compute_<version>, etc.), avec des besoins pessimistes.
+
+#define VERSION_DOUBLE_BUFFER  1  // utilise alt_image (next_img, swap_images)
+#define VERSION_OPENCL         2  // image sur le périphérique : ocl_init, ocl_send_image...
+#define VERSION_INDEXED        4  // sait écrire des indices de palette dans index_image (-ix)
+#define VERSION_STABILIZES     8  // the_compute peut renvoyer une valeur non nulle
+#define VERSION_NO_CHECK      16  // image volontairement différente de seq (ignorée par --check)
+#define VERSION_SEQUENTIAL    32  // ni OpenMP ni sched : --bench ne la mesure qu'une fois, avec un thread
+
+typedef struct {
+  const char *name;
+  int_func_t compute;
+  void_func_t init;         // optionnels
+  void_func_t finalize;
+  void_func_t first_touch;
+  unsigned flags;
+} version_desc_t;
+
+typedef struct {
+  const char *name;
+  version_desc_t *versions; // terminé par une entrée de nom NULL
+  tile_func_t tile;         // optionnels
+  tuning_kernel_t *tuning;
+  navigate_func_t navigate; // déplacement du cadre (--interactive)
+} kernel_desc_t;
+
+void registry_add (kernel_desc_t *k);
+kernel_desc_t *registry_kernel (const char *name);
+version_desc_t *registry_version (kernel_desc_t *k, const char *version);
+
+// Version courante (bind_functions)
+extern version_desc_t *the_version;
+
+#define REGISTER_KERNEL(desc)						\
+  static void __attribute__ ((constructor)) register_##desc (void)	\
+  {									\
+    registry_add (&desc);						\
+  }
+
+
+#endif
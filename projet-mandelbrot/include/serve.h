@@ -0,0 +1,30 @@
+
+#ifndef SERVE_IS_DEF
+#define SERVE_IS_DEF
+
+
+// Serveur de tuiles (--serve <port|chemin>) : prog reste lancé et répond
+// en HTTP, sur 127.0.0.1:<port> ou sur la socket Unix <chemin>, à
+//
+//   GET /tile?x=<x>&y=<y>&zoom=<z>&size=<s>
+//       tuile (x, y) de s x s pixels, au format PPM, du cadre courant du
+//       noyau vu comme une image de (s << z) pixels de côté (0 <= x, y < 2^z)
+//   GET /stats
+//       requêtes, taux de succès du cache, latences (p50, p99...)
+//
+// Les requêtes sont traitées par un groupe de SERVE_WORKERS threads
+// (par défaut un par cœur) qui calculent les tuiles avec la fonction
+// tile du noyau. Les tuiles calculées sont gardées dans un cache LRU
+// borné à SERVE_CACHE_MB Mio ; une requête identique à une tuile en
+// cours de calcul attend ce calcul plutôt que de le refaire. Les
+// statistiques sont aussi affichées à l'arrêt (SIGINT, SIGTERM).
+
+#define SERVE_MAX_SIZE 1024
+#define SERVE_MAX_ZOOM 40
+
+void serve_run (char *address);
+
+extern char *serve_address;
+
+
+#endif
@@ -0,0 +1,50 @@
+
+#ifndef TIMING_IS_DEF
+#define TIMING_IS_DEF
+
+
+#include <time.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMING_HAVE_TSC
+#endif
+
+// Horloge monotone, en millisecondes : insensible aux réglages de l'heure
+// système, contrairement à gettimeofday
+static inline double timing_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Estampilles à grain fin : compteur de cycles (rdtsc) si timing_init l'a
+// jugé fiable (TSC invariant), CLOCK_MONOTONIC en ns sinon. Seule la
+// différence de deux estampilles a un sens (timing_ns).
+
+void timing_init (void);
+
+extern double timing_tsc_ns; // ns par cycle, 0 si rdtsc n'est pas utilisé
+
+static inline uint64_t timing_stamp (void)
+{
+  struct timespec ts;
+
+#ifdef TIMING_HAVE_TSC
+  if (timing_tsc_ns > 0)
+    return __rdtsc ();
+#endif
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t timing_ns (uint64_t start, uint64_t end)
+{
+  return timing_tsc_ns > 0 ? (uint64_t) ((end - start) * timing_tsc_ns) : end - start;
+}
+
+
+#endif
@@ -0,0 +1,38 @@
+
+#ifndef TUNING_IS_DEF
+#define TUNING_IS_DEF
+
+
+// Réglage automatique (--autotune) des paramètres de performance d'un
+// noyau : grain des tuiles, taille des paquets OpenMP, taille des
+// groupes de travail OpenCL... Le meilleur réglage trouvé pour une
+// machine, un noyau, une version, DIM et un nombre de threads est
+// ajouté au fichier de profil (TUNING_PROFILE, tuning.profile par
+// défaut), relu automatiquement par les exécutions suivantes.
+
+#define TUNE_DIVIDES_DIM  1  // la valeur doit diviser DIM
+#define TUNE_OCL_REBUILD  2  // changer la valeur impose de recompiler le programme OpenCL
+
+typedef struct {
+  const char *name;       // nom dans le fichier de profil
+  unsigned *value;        // variable lue par le noyau
+  const char *versions;   // versions concernées, séparées par des virgules (NULL : toutes)
+  unsigned min, max;      // bornes des valeurs essayées
+  unsigned flags;
+  int (*valid) (unsigned value); // contrainte supplémentaire (optionnelle)
+} tuning_param_t;
+
+// Exporté par un noyau sous le nom <kernel>_tuning
+typedef struct {
+  tuning_param_t *params; // terminé par une entrée de nom NULL
+  void (*rewind) (void);  // remet le noyau dans son état initial avant chaque mesure (optionnel)
+} tuning_kernel_t;
+
+void tuning_load_profile (const char *kernel);
+void tuning_autotune (const char *kernel);
+
+extern tuning_kernel_t *the_tuning;
+extern unsigned do_autotune;
+
+
+#endif
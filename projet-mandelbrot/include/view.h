@@ -0,0 +1,37 @@
+
+#ifndef VIEW_IS_DEF
+#define VIEW_IS_DEF
+
+
+// Navigation interactive (--interactive) : la molette zoome autour du
+// pointeur, le glisser (bouton gauche) déplace le cadre. Le calcul tourne
+// dans un thread à part ; chaque déplacement demandé :
+//  - annule les tuiles pas encore commencées de l'image en cours
+//    (view_cancelled, testé par les versions tuilées) ;
+//  - est appliqué par le noyau (navigate) entre deux images ;
+//  - est d'abord affiché en aperçu grossier (1/VIEW_PREVIEW de la
+//    résolution, via the_tile), puis à pleine résolution. L'aperçu
+//    étant en couleurs, l'affichage indexé (-ix) est désactivé.
+// Sous 't', la latence entre l'action et l'affichage de son aperçu est
+// rapportée (phase input).
+
+#define VIEW_PREVIEW 8
+
+// Déplacement relatif : le nouveau cadre est le carré [u, u + k] x
+// [v, v + k] de l'ancien (coordonnées dans [0, 1], v vers le bas)
+typedef void (*navigate_func_t) (double u, double v, double k);
+
+void view_request (double u, double v, double k);
+void view_interactive (navigate_func_t navigate);
+
+extern unsigned do_interactive;
+extern unsigned view_generation;       // incrémenté à chaque demande
+extern unsigned view_frame_generation; // celle de l'image en cours de calcul
+
+static inline int view_cancelled (void)
+{
+  return __atomic_load_n (&view_generation, __ATOMIC_RELAXED) != view_frame_generation;
+}
+
+
+#endif
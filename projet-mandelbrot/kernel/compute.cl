@@ -126,6 +126,46 @@ __kernel void mandel (__global unsigned *img,
 }
 
 
+// Version "batch" : nb images calculées par un seul lancement, la
+// troisième dimension du NDRange indexant l'image. Le cadre de l'image k
+// est view [k] = (leftX, xstep, topY, ystep). Seule la dernière image est
+// conservée dans img ; les autres sont écrites dans scratch (jamais relu),
+// pour que leur calcul ne soit pas éliminé par le compilateur.
+__kernel void mandel_batch (__global unsigned *img, __global unsigned *scratch,
+			    __global float4 *view, unsigned MAX_ITERATIONS)
+{
+  int i = get_global_id (1);
+  int j = get_global_id (0);
+  int k = get_global_id (2);
+  float4 v = view [k];
+
+  float xc = v.x + v.y * j;
+  float yc = v.z - v.w * i;
+  float x = 0.0, y = 0.0;	/* Z = X+I*Y */
+
+  unsigned iter;
+
+  for (iter = 0; iter < MAX_ITERATIONS; iter++) {
+    float x2 = x*x;
+    float y2 = y*y;
+
+    /* Stop iterations when |Z| > 2 */
+    if (x2 + y2 > 4.0)
+      break;
+
+    float twoxy = (float)2.0 * x * y;
+    /* Z = Z^2 + C */
+    x = x2 - y2 + xc;
+    y = twoxy + yc;
+  }
+
+  __global unsigned *out = (k == get_global_size (2) - 1) ? img : scratch;
+
+  out [i * DIM + j] = (iter < MAX_ITERATIONS)
+    ? mandel_iter2color (iter)
+    : 0x000000FF; // black
+}
+
 
 // NE PAS MODIFIER
 static float4 color_scatter (unsigned c)
@@ -1,19 +1,8 @@
 
-export OMP_NUM_THREADS
-
-ITE=$(seq 3) # nombre de mesures
+ITE=3 # nombre de mesures
   
-THREADS=$(seq 2 2 24) # nombre de threads
-
-PARAM="./prog -s 512 -k mandel -n -i 100 -v " # parametres commun à toutes les executions 
-
-execute (){
-EXE="$PARAM $*"
-OUTPUT="$(echo $* | tr -d ' ')"
-for nb in $ITE; do for OMP_NUM_THREADS in $THREADS; do  echo -n "$OMP_NUM_THREADS " >> $OUTPUT ; $EXE 2>> $OUTPUT; done; done
-}
+THREADS=$(seq -s, 2 2 24) # nombre de threads
 
-execute omps
-execute ompd
-execute omptiled
-execute omptask
+# Toutes les mesures dans un seul processus, résultats dans mandel.csv
+./prog -s 512 -k mandel -i 100 \
+       --bench omps,ompd,omptiled,omptask --bench-threads $THREADS --bench-reps $ITE --bench-output mandel.csv
@@ -1,17 +1,8 @@
 
-export OMP_NUM_THREADS
-
-ITE=$(seq 3) # nombre de mesures
+ITE=3 # nombre de mesures
   
-THREADS=$(seq 2 2 24) # nombre de threads
-
-PARAM="./prog -l images/shibuya.png -k scrollup -n -i 500 -v " # parametres commun à toutes les executions 
-
-execute (){
-EXE="$PARAM $*"
-OUTPUT="$(echo $* | tr -d ' ')"
-for nb in $ITE; do for OMP_NUM_THREADS in $THREADS; do  echo -n "$OMP_NUM_THREADS " >> $OUTPUT ; $EXE 2>> $OUTPUT; done; done
-}
+THREADS=$(seq -s, 2 2 24) # nombre de threads
 
-execute omp
-execute omp_d
+# Toutes les mesures dans un seul processus, résultats dans scrollup.csv
+./prog -l images/shibuya.png -k scrollup -i 500 \
+       --bench omp,omp_d --bench-threads $THREADS --bench-reps $ITE --bench-output scrollup.csv
@@ -0,0 +1,303 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <omp.h>
+
+#include "global.h"
+#include "graphics.h"
+#include "compute.h"
+#include "error.h"
+#include "ocl.h"
+#include "tuning.h"
+#include "timing.h"
+#include "bench.h"
+#include "perfctr.h"
+#include "registry.h"
+#include "plugin.h"
+
+#define MAX_BENCH_VERSIONS 32
+#define MAX_BENCH_THREADS  64
+#define DEFAULT_BENCH_ITER 10
+
+char *bench_versions = NULL;
+char *bench_threads = NULL;
+char *bench_output = NULL;
+unsigned bench_reps = 5;
+unsigned bench_warmup = 1;
+
+struct bench_result {
+  char *version;
+  unsigned threads;
+  double median, min, mean, stddev;
+  double counters [PERFCTR_NB]; // par exécution, -1 si indisponible
+};
+
+static Uint32 *initial_image = NULL;
+
+static int compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+// Une exécution de max_iter itérations depuis l'état initial, comme la
+// boucle sans affichage de main
+static double bench_once (void)
+{
+  int iterations = 0;
+  double t;
+
+  memcpy (image, initial_image, (size_t) DIM * DIM * sizeof (Uint32));
+  if (opencl_used)
+    ocl_send_image (image);
+  if (the_tuning != NULL && the_tuning->rewind != NULL)
+    the_tuning->rewind ();
+
+  t = timing_now ();
+
+  while (iterations < max_iter) {
+    unsigned n;
+
+    perfctr_begin ();
+    n = the_compute (refresh_rate);
+    perfctr_end (n > 0 ? n : refresh_rate);
+
+    if (opencl_used)
+      ocl_readback ();
+    if (n > 0) {
+      iterations += n;
+      break;
+    }
+    iterations += refresh_rate;
+  }
+
+  if (opencl_used)
+    ocl_readback_flush ();
+
+  return timing_now () - t;
+}
+
+static void bench_setup (const char *kernel, char *v, unsigned threads)
+{
+  char str [16];
+
+  // Pris en compte par OpenMP comme par l'ordonnanceur de sched
+  sprintf (str, "%u", threads);
+  setenv ("OMP_NUM_THREADS", str, 1);
+  omp_set_num_threads (threads);
+
+  version = v;
+  opencl_used = !strncmp (v, "ocl", 3);
+
+  bind_functions ();
+
+  if (the_init != NULL)
+    the_init ();
+
+  tuning_load_profile (kernel);
+
+  if (opencl_used)
+    ocl_init ();
+}
+
+static void bench_measure (struct bench_result *r)
+{
+  double t [bench_reps];
+  double sum = 0.0, sum2 = 0.0;
+
+  for (unsigned i = 0; i < bench_warmup; i++)
+    bench_once ();
+
+  perfctr_reset ();
+
+  for (unsigned i = 0; i < bench_reps; i++) {
+    t [i] = bench_once ();
+    sum += t [i];
+  }
+
+  qsort (t, bench_reps, sizeof (double), compare_double);
+
+  r->min = t [0];
+  r->median = (bench_reps % 2) ? t [bench_reps / 2]
+    : (t [bench_reps / 2 - 1] + t [bench_reps / 2]) / 2;
+  r->mean = sum / bench_reps;
+
+  for (unsigned i = 0; i < bench_reps; i++)
+    sum2 += (t [i] - r->mean) * (t [i] - r->mean);
+  r->stddev = bench_reps > 1 ? sqrt (sum2 / (bench_reps - 1)) : 0.0;
+
+  perfctr_totals (r->counters);
+  for (int e = 0; e < PERFCTR_NB; e++)
+    if (r->counters [e] >= 0)
+      r->counters [e] /= bench_reps;
+
+  fprintf (stderr, "%s, %u threads: median %.3f ms, min %.3f ms\n",
+	   r->version, r->threads, r->median, r->min);
+}
+
+static unsigned split_list (char *list, char **items, unsigned max)
+{
+  unsigned n = 0;
+
+  for (char *tok = strtok (list, ","); tok != NULL && n < max; tok = strtok (NULL, ","))
+    items [n++] = tok;
+
+  return n;
+}
+
+static void bench_report (const char *kernel, struct bench_result *res, unsigned n, double ref)
+{
+  char host [256];
+  FILE *f = stdout;
+  int json = 0;
+
+  if (gethostname (host, sizeof (host)) < 0)
+    strcpy (host, "unknown");
+  host [sizeof (host) - 1] = '\0';
+
+  if (bench_output != NULL && strcmp (bench_output, "-")) {
+    size_t len = strlen (bench_output);
+
+    json = len > 5 && !strcmp (bench_output + len - 5, ".json");
+    f = fopen (bench_output, "w");
+    if (f == NULL)
+      exit_with_error ("Cannot open %s\n", bench_output);
+  }
+
+  if (json) {
+    fprintf (f, "{\n  \"host\": \"%s\",\n  \"kernel\": \"%s\",\n  \"isa\": \"%s\",\n  \"dim\": %u,\n",
+	     host, kernel, plugin_isa, DIM);
+    fprintf (f, "  \"iterations\": %d,\n  \"reps\": %u,\n  \"warmup\": %u,\n", max_iter, bench_reps, bench_warmup);
+    fprintf (f, "  \"results\": [\n");
+    for (unsigned i = 0; i < n; i++) {
+      fprintf (f, "    { \"version\": \"%s\", \"threads\": %u, \"median_ms\": %.3f, \"min_ms\": %.3f,"
+	       " \"mean_ms\": %.3f, \"stddev_ms\": %.3f, \"speedup\": %.3f",
+	       res [i].version, res [i].threads, res [i].median, res [i].min,
+	       res [i].mean, res [i].stddev, ref / res [i].median);
+      if (perfctr_enabled)
+	for (int e = 0; e < PERFCTR_NB; e++)
+	  if (res [i].counters [e] >= 0)
+	    fprintf (f, ", \"%s\": %.0f", perfctr_name [e], res [i].counters [e]);
+      fprintf (f, " }%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf (f, "  ]\n}\n");
+  } else {
+    fprintf (f, "host,kernel,isa,dim,iterations,reps,version,threads,median_ms,min_ms,mean_ms,stddev_ms,speedup");
+    if (perfctr_enabled)
+      for (int e = 0; e < PERFCTR_NB; e++)
+	fprintf (f, ",%s", perfctr_name [e]);
+    fprintf (f, "\n");
+
+    for (unsigned i = 0; i < n; i++) {
+      fprintf (f, "%s,%s,%s,%u,%d,%u,%s,%u,%.3f,%.3f,%.3f,%.3f,%.3f",
+	       host, kernel, plugin_isa, DIM, max_iter, bench_reps, res [i].version, res [i].threads,
+	       res [i].median, res [i].min, res [i].mean, res [i].stddev, ref / res [i].median);
+      // Compteurs matériels moyens par exécution (vide si indisponible)
+      if (perfctr_enabled)
+	for (int e = 0; e < PERFCTR_NB; e++) {
+	  if (res [i].counters [e] >= 0)
+	    fprintf (f, ",%.0f", res [i].counters [e]);
+	  else
+	    fprintf (f, ",");
+	}
+      fprintf (f, "\n");
+    }
+  }
+
+  if (f != stdout)
+    fclose (f);
+}
+
+void bench_run (const char *kernel)
+{
+  char *versions [MAX_BENCH_VERSIONS + 1];
+  unsigned threads [MAX_BENCH_THREADS];
+  char *thread_list [MAX_BENCH_THREADS];
+  struct bench_result *res;
+  unsigned nv, nt, n = 0;
+  double ref = 0.0;
+
+  if (bench_reps == 0)
+    exit_with_error ("At least one repetition is needed\n");
+
+  if (max_iter == 0)
+    max_iter = DEFAULT_BENCH_ITER;
+
+  // La référence seq est toujours mesurée, en premier, et une seule fois
+  versions [0] = "seq";
+  nv = 1;
+  if (!strcmp (bench_versions, "all")) {
+    // Toutes les versions déclarées par le noyau
+    kernel_desc_t *k = registry_kernel (kernel);
+
+    if (k == NULL)
+      exit_with_error ("Kernel %s is not registered, list its versions\n", kernel);
+
+    for (version_desc_t *d = k->versions; d->name != NULL && nv <= MAX_BENCH_VERSIONS; d++)
+      if (strcmp (d->name, "seq"))
+	versions [nv++] = (char *) d->name;
+  } else {
+    char *list [MAX_BENCH_VERSIONS];
+    unsigned nl = split_list (bench_versions, list, MAX_BENCH_VERSIONS);
+
+    for (unsigned i = 0; i < nl; i++)
+      if (strcmp (list [i], "seq"))
+	versions [nv++] = list [i];
+  }
+
+  if (bench_threads != NULL) {
+    nt = split_list (bench_threads, thread_list, MAX_BENCH_THREADS);
+    for (unsigned i = 0; i < nt; i++)
+      threads [i] = atoi (thread_list [i]);
+  } else {
+    nt = 1;
+    threads [0] = omp_get_max_threads ();
+  }
+
+  res = malloc (nv * nt * sizeof (struct bench_result));
+
+  initial_image = malloc ((size_t) DIM * DIM * sizeof (Uint32));
+  memcpy (initial_image, image, (size_t) DIM * DIM * sizeof (Uint32));
+
+  // Configuration initiale de main : remplacée par celles de la campagne
+  if (the_finalize != NULL)
+    the_finalize ();
+
+  for (unsigned v = 0; v < nv; v++) {
+    // seq, comme les versions sans OpenMP ni sched (dont OpenCL), ne
+    // dépend pas du nombre de threads
+    kernel_desc_t *k = registry_kernel (kernel);
+    version_desc_t *d = (k != NULL) ? registry_version (k, versions [v]) : NULL;
+    int single = (v == 0)
+      || (d != NULL && (d->flags & (VERSION_SEQUENTIAL | VERSION_OPENCL)));
+    unsigned count = single ? 1 : nt;
+
+    for (unsigned t = 0; t < count; t++) {
+      unsigned p = single ? 1 : threads [t];
+
+      bench_setup (kernel, versions [v], p);
+
+      res [n].version = versions [v];
+      res [n].threads = p;
+      bench_measure (&res [n]);
+      n++;
+
+      if (v == 0)
+	ref = res [0].median;
+
+      // La dernière configuration est finalisée par main
+      if (v + 1 < nv || t + 1 < count)
+	if (the_finalize != NULL)
+	  the_finalize ();
+    }
+  }
+
+  bench_report (kernel, res, n, ref);
+
+  free (initial_image);
+  free (res);
+}
@@ -0,0 +1,409 @@
+
+#include "constants.h"
+#include "global.h"
+#include "compute.h"
+#include "graphics.h"
+#include "debug.h"
+#include "error.h"
+#include "scheduler.h"
+#include "registry.h"
+#include "first_touch.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+// Buddhabrot : on tire des points c au hasard et on accumule, dans un
+// histogramme de densité de DIM x DIM cases, tous les termes de la suite
+// z <- z^2 + c des points qui s'échappent (BUDDHA_MODE=anti, Anti-
+// Buddhabrot : de ceux qui ne s'échappent pas en BUDDHA_ITER itérations).
+// L'image est le logarithme de la densité, rapporté à son maximum.
+//
+// Chaque thread (ou ouvrier de sched) accumule dans son propre
+// histogramme, sans opération atomique. À la fin de chaque appel à
+// compute, les histogrammes privés sont réduits bloc de pixels par bloc
+// de pixels, en arbre (h0 += h1, h2 += h3... puis h0 += h2...), dans la
+// densité cumulée, et l'image est recalculée.
+//
+// Le k-ième point tiré ne dépend que de k (générateur à compteur) : la
+// densité, donc l'image, ne dépend ni du nombre de threads ni de l'ordre
+// des calculs, et omp et sched donnent exactement l'image de seq.
+
+#define BUDDHA_CHUNK  4096 // points par paquet (omp) ou par tâche (sched)
+#define REDUCE_BLOCK  4096 // pixels par bloc de réduction
+
+// Fenêtre du plan complexe ; l'axe réel est vertical, pointe en haut
+#define RE_MIN -2.0
+#define RE_MAX  1.0
+#define IM_MIN -1.5
+#define IM_MAX  1.5
+
+static unsigned long nb_samples = 1UL << 20; // points tirés par image
+static unsigned buddha_iter = 1000;
+static int anti = 0;
+
+static unsigned nb_hist = 0;
+static unsigned **hist = NULL;          // histogrammes privés
+static unsigned long *density = NULL;   // densité cumulée
+static unsigned long *block_max = NULL; // maximum de chaque bloc de density
+static unsigned nb_blocks;
+static double log_max;
+
+static unsigned long sample_base; // numéro du premier point de l'appel en cours
+static double buddha_time;        // temps passé dans compute
+
+static void buddha_config (void)
+{
+  char *str;
+
+  str = getenv ("BUDDHA_SAMPLES");
+  if (str != NULL && (nb_samples = atol (str)) == 0)
+    exit_with_error ("BUDDHA_SAMPLES must be a positive number of samples per frame\n");
+
+  str = getenv ("BUDDHA_ITER");
+  if (str != NULL && (buddha_iter = atoi (str)) == 0)
+    exit_with_error ("BUDDHA_ITER must be a positive number of iterations\n");
+
+  str = getenv ("BUDDHA_MODE");
+  if (str != NULL) {
+    if (!strcmp (str, "anti"))
+      anti = 1;
+    else if (strcmp (str, "normal"))
+      exit_with_error ("BUDDHA_MODE must be 'normal' or 'anti'\n");
+  }
+
+  sample_base = 0;
+  buddha_time = 0.0;
+}
+
+// DIM n'est connu qu'après graphics_init : allocations au premier appel
+// de compute. Les histogrammes privés sont alloués (et mis à zéro, donc
+// placés en mémoire) par leur propriétaire
+static void alloc_shared (unsigned n)
+{
+  nb_hist = n;
+  hist = calloc (n, sizeof (unsigned *));
+  nb_blocks = ((unsigned long) DIM * DIM + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+  block_max = malloc (nb_blocks * sizeof (unsigned long));
+  density = calloc ((size_t) DIM * DIM, sizeof (unsigned long));
+}
+
+static void alloc_private (unsigned t)
+{
+  hist [t] = malloc ((size_t) DIM * DIM * sizeof (unsigned));
+  memset (hist [t], 0, (size_t) DIM * DIM * sizeof (unsigned));
+}
+
+void buddha_finalize_seq (void)
+{
+  if (hist == NULL)
+    return;
+
+  if (buddha_time > 0.0)
+    printf ("buddha: %lu samples in %.3f s (%.2f Msamples/s)\n",
+	    sample_base, buddha_time, sample_base / buddha_time * 1e-6);
+
+  for (unsigned t = 0; t < nb_hist; t++)
+    free (hist [t]);
+  free (hist);
+  free (block_max);
+  free (density);
+  hist = NULL;
+}
+
+void buddha_init_seq (void)
+{
+  buddha_config ();
+}
+
+// Générateur à compteur : finaliseur de splitmix64 appliqué au numéro du
+// tirage ; deux flux par point, pour ses deux coordonnées
+static inline double uniform (uint64_t k, unsigned stream)
+{
+  uint64_t z = (2 * k + stream) * 0x9e3779b97f4a7c15ULL;
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+
+  return (z >> 11) * 0x1.0p-53;
+}
+
+// Cardioïde principale et disque de période 2 : aucun point ne s'en échappe
+static inline int in_main_bulbs (double x, double y)
+{
+  double q = (x - 0.25) * (x - 0.25) + y * y;
+
+  return q * (q + (x - 0.25)) <= 0.25 * y * y
+    || (x + 1.0) * (x + 1.0) + y * y <= 0.0625;
+}
+
+static void trace (unsigned *h, uint64_t k)
+{
+  double cr = RE_MIN + (RE_MAX - RE_MIN) * uniform (k, 0);
+  double ci = IM_MIN + (IM_MAX - IM_MIN) * uniform (k, 1);
+  double su = DIM / (RE_MAX - RE_MIN), sv = DIM / (IM_MAX - IM_MIN);
+  double x = 0.0, y = 0.0;
+  unsigned n;
+
+  if (!anti && in_main_bulbs (cr, ci))
+    return;
+
+  for (n = 0; n < buddha_iter; n++) {
+    double x2 = x * x, y2 = y * y;
+
+    if (x2 + y2 > 4.0)
+      break;
+
+    y = 2.0 * x * y + ci;
+    x = x2 - y2 + cr;
+  }
+
+  // Buddhabrot : points échappés ; Anti-Buddhabrot : les autres
+  if ((n < buddha_iter) == anti)
+    return;
+
+  // Second parcours de l'orbite, pour l'accumuler
+  x = y = 0.0;
+  for (unsigned m = 0; m < n; m++) {
+    double t = x * x - y * y + cr;
+    double u, v;
+
+    y = 2.0 * x * y + ci;
+    x = t;
+
+    u = (x - RE_MIN) * su;
+    v = (y - IM_MIN) * sv;
+    if (u >= 0.0 && u < DIM && v >= 0.0 && v < DIM)
+      h [(unsigned) u * DIM + (unsigned) v]++;
+  }
+}
+
+static void trace_chunk (unsigned *h, unsigned long c, unsigned long total)
+{
+  unsigned long end = MIN ((c + 1) * BUDDHA_CHUNK, total);
+
+  for (unsigned long k = c * BUDDHA_CHUNK; k < end; k++)
+    trace (h, sample_base + k);
+}
+
+static void reduce_block (unsigned b)
+{
+  unsigned long k0 = (unsigned long) b * REDUCE_BLOCK;
+  unsigned long k1 = MIN (k0 + REDUCE_BLOCK, (unsigned long) DIM * DIM);
+  unsigned long m = 0;
+
+  for (unsigned s = 1; s < nb_hist; s *= 2)
+    for (unsigned t = 0; t + s < nb_hist; t += 2 * s)
+      for (unsigned long k = k0; k < k1; k++) {
+	hist [t][k] += hist [t + s][k];
+	hist [t + s][k] = 0;
+      }
+
+  for (unsigned long k = k0; k < k1; k++) {
+    density [k] += hist [0][k];
+    hist [0][k] = 0;
+    if (density [k] > m)
+      m = density [k];
+  }
+
+  block_max [b] = m;
+}
+
+static void compute_log_max (void)
+{
+  unsigned long m = 0;
+
+  for (unsigned b = 0; b < nb_blocks; b++)
+    m = MAX (m, block_max [b]);
+
+  log_max = log1p (m);
+}
+
+// Tons : log (1 + densité) / log (1 + densité max), en niveaux de gris
+static void tone_block (unsigned b)
+{
+  unsigned long k0 = (unsigned long) b * REDUCE_BLOCK;
+  unsigned long k1 = MIN (k0 + REDUCE_BLOCK, (unsigned long) DIM * DIM);
+
+  for (unsigned long k = k0; k < k1; k++) {
+    unsigned g = log_max > 0.0 ? 255.0 * log1p (density [k]) / log_max : 0;
+
+    image [k] = (g << 24) | (g << 16) | (g << 8) | 255;
+  }
+}
+
+static void end_of_call (unsigned long total, double start)
+{
+  sample_base += total;
+  buddha_time += omp_get_wtime () - start;
+
+  PRINT_DEBUG ('p', "buddha: %lu samples so far, %.2f Msamples/s\n",
+	       sample_base, sample_base / buddha_time * 1e-6);
+}
+
+///////////////////////////// Version séquentielle simple (seq)
+
+unsigned buddha_compute_seq (unsigned nb_iter)
+{
+  unsigned long total = nb_samples * nb_iter;
+  unsigned long nb_chunks = (total + BUDDHA_CHUNK - 1) / BUDDHA_CHUNK;
+  double start = omp_get_wtime ();
+
+  if (hist == NULL) {
+    alloc_shared (1);
+    alloc_private (0);
+  }
+
+  for (unsigned long c = 0; c < nb_chunks; c++)
+    trace_chunk (hist [0], c, total);
+
+  for (unsigned b = 0; b < nb_blocks; b++)
+    reduce_block (b);
+
+  compute_log_max ();
+
+  for (unsigned b = 0; b < nb_blocks; b++)
+    tone_block (b);
+
+  end_of_call (total, start);
+
+  return 0;
+}
+
+///////////////////////////// Version OpenMP (omp)
+
+unsigned buddha_compute_omp (unsigned nb_iter)
+{
+  unsigned long total = nb_samples * nb_iter;
+  unsigned long nb_chunks = (total + BUDDHA_CHUNK - 1) / BUDDHA_CHUNK;
+  double start = omp_get_wtime ();
+
+  if (hist == NULL) {
+    alloc_shared (omp_get_max_threads ());
+
+    #pragma omp parallel
+    alloc_private (omp_get_thread_num ());
+  }
+
+  #pragma omp parallel
+  {
+    unsigned *h = hist [omp_get_thread_num ()];
+
+    #pragma omp for schedule(dynamic)
+    for (unsigned long c = 0; c < nb_chunks; c++)
+      trace_chunk (h, c, total);
+
+    #pragma omp for schedule(static)
+    for (unsigned b = 0; b < nb_blocks; b++)
+      reduce_block (b);
+
+    #pragma omp single
+    compute_log_max ();
+
+    #pragma omp for schedule(static)
+    for (unsigned b = 0; b < nb_blocks; b++)
+      tone_block (b);
+  }
+
+  end_of_call (total, start);
+
+  return 0;
+}
+
+// Blocs contigus de lignes, comme le schedule(static) de tone_block
+static void buddha_ft_omp (void)
+{
+  first_touch_rows (0);
+}
+
+///////////////////////////// Version utilisant l'ordonnanceur maison (sched)
+
+static unsigned nb_workers;
+static unsigned long sched_total;
+
+void buddha_init_sched (void)
+{
+  buddha_config ();
+
+  nb_workers = scheduler_init (-1);
+}
+
+void buddha_finalize_sched (void)
+{
+  buddha_finalize_seq ();
+
+  scheduler_finalize ();
+}
+
+static void alloc_task (void *p, unsigned proc)
+{
+  alloc_private (proc);
+}
+
+static void sample_task (void *p, unsigned proc)
+{
+  trace_chunk (hist [proc], (unsigned long) p, sched_total);
+}
+
+static void reduce_task (void *p, unsigned proc)
+{
+  reduce_block ((unsigned long) p);
+}
+
+static void tone_task (void *p, unsigned proc)
+{
+  tone_block ((unsigned long) p);
+}
+
+unsigned buddha_compute_sched (unsigned nb_iter)
+{
+  unsigned long nb_chunks;
+  double start = omp_get_wtime ();
+
+  sched_total = nb_samples * nb_iter;
+  nb_chunks = (sched_total + BUDDHA_CHUNK - 1) / BUDDHA_CHUNK;
+
+  if (hist == NULL) {
+    alloc_shared (nb_workers);
+
+    // Chaque ouvrier alloue son histogramme
+    for (unsigned w = 0; w < nb_workers; w++)
+      scheduler_create_task (alloc_task, NULL, w);
+    scheduler_task_wait ();
+  }
+
+  for (unsigned long c = 0; c < nb_chunks; c++)
+    scheduler_create_task (sample_task, (void *) c, -1);
+  scheduler_task_wait ();
+
+  for (unsigned long b = 0; b < nb_blocks; b++)
+    scheduler_create_task (reduce_task, (void *) b, -1);
+  scheduler_task_wait ();
+
+  compute_log_max ();
+
+  for (unsigned long b = 0; b < nb_blocks; b++)
+    scheduler_create_task (tone_task, (void *) b, -1);
+  scheduler_task_wait ();
+
+  end_of_call (sched_total, start);
+
+  return 0;
+}
+
+///////////////////////////// Registre des versions
+
+static version_desc_t buddha_versions [] = {
+  { "seq",   buddha_compute_seq,   buddha_init_seq,   buddha_finalize_seq,   NULL,
+    VERSION_SEQUENTIAL },
+  { "omp",   buddha_compute_omp,   buddha_init_seq,   buddha_finalize_seq,
+    buddha_ft_omp, 0 },
+  { "sched", buddha_compute_sched, buddha_init_sched, buddha_finalize_sched, NULL, 0 },
+  { NULL }
+};
+
+static kernel_desc_t buddha_kernel = { "buddha", buddha_versions, NULL, NULL };
+
+REGISTER_KERNEL (buddha_kernel)
@@ -0,0 +1,434 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+#include "global.h"
+#include "graphics.h"
+#include "compute.h"
+#include "error.h"
+#include "constants.h"
+#include "ocl.h"
+#include "hash.h"
+#include "check.h"
+#include "registry.h"
+
+#define MAX_CHECK_VERSIONS 64
+#define DEFAULT_CHECK_ITER 5
+#define DEFAULT_TIMEOUT    300 // secondes, par version
+
+unsigned do_check = 0;
+
+static unsigned nb_frames, tiles_per_row, nb_tiles;
+static size_t pixel_size; // 1 en affichage indexé, 4 sinon
+
+// Ce que le fils envoie pour chaque image
+struct frame {
+  unsigned ret;       // valeur rendue par the_compute
+  uint64_t *tiles;    // empreinte de chaque tuile
+};
+
+struct run {
+  int status;         // tel que rendu par waitpid
+  unsigned frames;    // images effectivement reçues
+  struct frame *frame;
+  void *dump;         // pixels de l'image demandée, ou NULL
+};
+
+static int compare_string (const void *a, const void *b)
+{
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+static int add_version (char **versions, unsigned n, const char *v)
+{
+  for (unsigned i = 0; i < n; i++)
+    if (!strcmp (versions [i], v))
+      return n;
+
+  if (n < MAX_CHECK_VERSIONS)
+    versions [n++] = strdup (v);
+
+  return n;
+}
+
+#ifdef __linux__
+
+// Noyau non enregistré : ses versions sont les fonctions
+// <kernel>_compute_* de la table des symboles de l'exécutable (celles
+// que bind_functions résout par dlsym)
+static unsigned find_versions (const char *kernel, char **versions)
+{
+  char prefix [256];
+  size_t len;
+  unsigned n = 0;
+  struct stat st;
+  Elf64_Ehdr *eh;
+  Elf64_Shdr *sh;
+  int fd, sym = -1;
+
+  len = snprintf (prefix, sizeof (prefix), "%s_compute_", kernel);
+
+  fd = open ("/proc/self/exe", O_RDONLY);
+  if (fd < 0 || fstat (fd, &st) < 0)
+    exit_with_error ("Cannot open /proc/self/exe\n");
+
+  eh = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (eh == MAP_FAILED || memcmp (eh->e_ident, ELFMAG, SELFMAG)
+      || eh->e_ident [EI_CLASS] != ELFCLASS64)
+    exit_with_error ("Cannot read the symbol table, set CHECK_VERSIONS\n");
+
+  sh = (Elf64_Shdr *) ((char *) eh + eh->e_shoff);
+
+  // Table complète si l'exécutable n'est pas strippé, dynamique sinon
+  for (int s = 0; s < eh->e_shnum; s++)
+    if (sh [s].sh_type == SHT_SYMTAB || (sh [s].sh_type == SHT_DYNSYM && sym < 0))
+      sym = s;
+
+  if (sym >= 0) {
+    Elf64_Sym *syms = (Elf64_Sym *) ((char *) eh + sh [sym].sh_offset);
+    char *names = (char *) eh + sh [sh [sym].sh_link].sh_offset;
+
+    for (size_t k = 0; k < sh [sym].sh_size / sizeof (Elf64_Sym); k++)
+      if (ELF64_ST_TYPE (syms [k].st_info) == STT_FUNC
+	  && ELF64_ST_BIND (syms [k].st_info) == STB_GLOBAL && syms [k].st_shndx != SHN_UNDEF
+	  && !strncmp (names + syms [k].st_name, prefix, len))
+	n = add_version (versions, n, names + syms [k].st_name + len);
+  }
+
+  munmap (eh, st.st_size);
+
+  return n;
+}
+
+#else
+
+static unsigned find_versions (const char *kernel, char **versions)
+{
+  exit_with_error ("Cannot list versions on this system, set CHECK_VERSIONS\n");
+}
+
+#endif
+
+static void *frame_pixels (void)
+{
+  return index_image != NULL ? (void *) index_image : (void *) image;
+}
+
+static void hash_tiles (uint64_t *tiles)
+{
+  unsigned char *pixels = frame_pixels ();
+
+  for (unsigned t = 0; t < nb_tiles; t++) {
+    unsigned row = (t / tiles_per_row) * CHECK_TILE, col = (t % tiles_per_row) * CHECK_TILE;
+    unsigned h = MIN (CHECK_TILE, DIM - row), w = MIN (CHECK_TILE, DIM - col);
+    uint64_t hash = HASH_INIT;
+
+    for (unsigned i = row; i < row + h; i++)
+      hash = hash_bytes (hash, pixels + ((size_t) i * DIM + col) * pixel_size, w * pixel_size);
+    tiles [t] = hash;
+  }
+}
+
+static int write_full (int fd, const void *buf, size_t len)
+{
+  for (size_t done = 0; done < len;) {
+    ssize_t r = write (fd, (const char *) buf + done, len - done);
+
+    if (r <= 0)
+      return 0;
+    done += r;
+  }
+  return 1;
+}
+
+static int read_full (int fd, void *buf, size_t len)
+{
+  for (size_t done = 0; done < len;) {
+    ssize_t r = read (fd, (char *) buf + done, len - done);
+
+    if (r <= 0)
+      return 0;
+    done += r;
+  }
+  return 1;
+}
+
+// Processus fils : calcule nb_frames images avec la version v et envoie
+// leurs empreintes (et les pixels de l'image dump, si dump >= 0)
+static void check_child (int fd, char *v, int dump, unsigned timeout)
+{
+  uint64_t *tiles = malloc (nb_tiles * sizeof (uint64_t));
+  int null = open ("/dev/null", O_WRONLY);
+
+  // Les messages des versions (« Using kernel... ») encombreraient le bilan
+  if (null >= 0)
+    dup2 (null, STDOUT_FILENO);
+
+  // Une version qui ne termine pas est aussi une version fautive
+  alarm (timeout);
+
+  version = v;
+  opencl_used = !strncmp (v, "ocl", 3);
+
+  bind_functions ();
+
+  if (the_init != NULL)
+    the_init ();
+
+  // Processus fils : le contexte OpenCL éventuel du père n'y est pas
+  // utilisable, on en crée un
+  ocl_initialized = 0;
+
+  if (opencl_used) {
+    ocl_init ();
+    ocl_send_image (image);
+  }
+
+  for (unsigned f = 0; f < nb_frames; f++) {
+    unsigned ret = the_compute (1);
+
+    if (opencl_used)
+      ocl_readback_flush ();
+
+    hash_tiles (tiles);
+
+    if (!write_full (fd, &ret, sizeof (ret))
+	|| !write_full (fd, tiles, nb_tiles * sizeof (uint64_t)))
+      _exit (EXIT_FAILURE);
+
+    if (f == dump && !write_full (fd, frame_pixels (), (size_t) DIM * DIM * pixel_size))
+      _exit (EXIT_FAILURE);
+  }
+
+  if (the_finalize != NULL)
+    the_finalize ();
+
+  _exit (EXIT_SUCCESS);
+}
+
+static void run_version (char *v, int dump, unsigned timeout, struct run *r)
+{
+  int fd [2];
+  pid_t pid;
+
+  r->frames = 0;
+  r->frame = calloc (nb_frames, sizeof (struct frame));
+  r->dump = NULL;
+
+  if (pipe (fd) < 0)
+    exit_with_error ("Cannot create pipe\n");
+
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+  if (pid < 0)
+    exit_with_error ("Cannot fork\n");
+
+  if (pid == 0) {
+    close (fd [0]);
+    check_child (fd [1], v, dump, timeout);
+  }
+
+  close (fd [1]);
+
+  for (unsigned f = 0; f < nb_frames; f++) {
+    struct frame *fr = &r->frame [f];
+
+    fr->tiles = malloc (nb_tiles * sizeof (uint64_t));
+    if (!read_full (fd [0], &fr->ret, sizeof (fr->ret))
+	|| !read_full (fd [0], fr->tiles, nb_tiles * sizeof (uint64_t)))
+      break;
+
+    if (f == dump) {
+      r->dump = malloc ((size_t) DIM * DIM * pixel_size);
+      if (!read_full (fd [0], r->dump, (size_t) DIM * DIM * pixel_size)) {
+	free (r->dump);
+	r->dump = NULL;
+	break;
+      }
+    }
+    r->frames++;
+  }
+
+  close (fd [0]);
+  waitpid (pid, &r->status, 0);
+}
+
+static void free_run (struct run *r)
+{
+  for (unsigned f = 0; f < nb_frames; f++)
+    free (r->frame [f].tiles);
+  free (r->frame);
+  free (r->dump);
+}
+
+static unsigned long diff_pixels (void *a, void *b, unsigned row, unsigned col,
+				  unsigned h, unsigned w)
+{
+  unsigned long n = 0;
+
+  for (unsigned i = row; i < row + h; i++)
+    for (unsigned j = col; j < col + w; j++) {
+      size_t o = ((size_t) i * DIM + j) * pixel_size;
+
+      n += memcmp ((char *) a + o, (char *) b + o, pixel_size) != 0;
+    }
+
+  return n;
+}
+
+// Compare r à la référence ; 0 si identiques
+static int check_compare (char *v, struct run *ref, struct run *r, struct run *ref_dumps,
+			  unsigned timeout)
+{
+  unsigned f, t = 0;
+
+  for (f = 0; f < r->frames; f++) {
+    if (r->frame [f].ret != ref->frame [f].ret)
+      break;
+    for (t = 0; t < nb_tiles; t++)
+      if (r->frame [f].tiles [t] != ref->frame [f].tiles [t])
+	break;
+    if (t < nb_tiles)
+      break;
+  }
+
+  if (f == nb_frames) {
+    if (WIFEXITED (r->status) && WEXITSTATUS (r->status) == EXIT_SUCCESS) {
+      printf ("  %-12s OK\n", v);
+      return 0;
+    }
+    printf ("  %-12s FAILED after the last frame\n", v);
+    return 1;
+  }
+
+  if (f == r->frames) {
+    if (WIFSIGNALED (r->status))
+      printf ("  %-12s FAILED at frame %u (%s)\n", v, f, strsignal (WTERMSIG (r->status)));
+    else
+      printf ("  %-12s FAILED at frame %u (exit status %d)\n", v, f,
+	      WIFEXITED (r->status) ? WEXITSTATUS (r->status) : -1);
+    return 1;
+  }
+
+  if (t == nb_tiles) {
+    printf ("  %-12s DIFF at frame %u: compute returned %u instead of %u\n", v, f,
+	    r->frame [f].ret, ref->frame [f].ret);
+    return 1;
+  }
+
+  // Première divergence : on refait tourner les deux versions jusqu'à
+  // l'image f pour en compter les pixels différents
+  {
+    unsigned row = (t / tiles_per_row) * CHECK_TILE, col = (t % tiles_per_row) * CHECK_TILE;
+    unsigned h = MIN (CHECK_TILE, DIM - row), w = MIN (CHECK_TILE, DIM - col);
+    unsigned bad_tiles = 0;
+    struct run dump;
+
+    for (unsigned k = 0; k < nb_tiles; k++)
+      bad_tiles += r->frame [f].tiles [k] != ref->frame [f].tiles [k];
+
+    if (ref_dumps [f].dump == NULL)
+      run_version ("seq", f, timeout, &ref_dumps [f]);
+    run_version (v, f, timeout, &dump);
+
+    printf ("  %-12s DIFF at frame %u, tile (%u, %u) [rows %u-%u, cols %u-%u]", v, f,
+	    row / CHECK_TILE, col / CHECK_TILE, row, row + h - 1, col, col + w - 1);
+
+    if (ref_dumps [f].dump != NULL && dump.dump != NULL)
+      printf (": %lu/%u pixels differ in tile, %lu in frame (%u/%u tiles)\n",
+	      diff_pixels (ref_dumps [f].dump, dump.dump, row, col, h, w), h * w,
+	      diff_pixels (ref_dumps [f].dump, dump.dump, 0, 0, DIM, DIM), bad_tiles, nb_tiles);
+    else
+      printf (" (%u/%u tiles differ)\n", bad_tiles, nb_tiles);
+
+    free_run (&dump);
+  }
+
+  return 1;
+}
+
+int check_run (const char *kernel)
+{
+  char *versions [MAX_CHECK_VERSIONS];
+  struct run ref, *ref_dumps;
+  unsigned nv = 0, timeout = DEFAULT_TIMEOUT;
+  int failed = 0;
+  char *str;
+
+  nb_frames = max_iter > 0 ? max_iter : DEFAULT_CHECK_ITER;
+  tiles_per_row = (DIM + CHECK_TILE - 1) / CHECK_TILE;
+  nb_tiles = tiles_per_row * tiles_per_row;
+  pixel_size = index_image != NULL ? sizeof (Uint8) : sizeof (Uint32);
+
+  str = getenv ("CHECK_TIMEOUT");
+  if (str != NULL)
+    timeout = atoi (str);
+
+  // CHECK_VERSIONS=v1,v2,... restreint (ou remplace) la liste trouvée
+  str = getenv ("CHECK_VERSIONS");
+  if (str != NULL) {
+    char *list = strdup (str);
+
+    for (char *tok = strtok (list, ","); tok != NULL; tok = strtok (NULL, ","))
+      nv = add_version (versions, nv, tok);
+    free (list);
+  } else if (registry_kernel (kernel) != NULL) {
+    for (version_desc_t *d = registry_kernel (kernel)->versions; d->name != NULL; d++)
+      if (!(d->flags & VERSION_NO_CHECK))
+	nv = add_version (versions, nv, d->name);
+  } else
+    nv = find_versions (kernel, versions);
+
+  qsort (versions, nv, sizeof (char *), compare_string);
+
+  printf ("Checking %u version%s of kernel [%s] against seq: %u frame%s of %ux%u, %ux%u tiles\n",
+	  nv, nv > 1 ? "s" : "", kernel, nb_frames, nb_frames > 1 ? "s" : "",
+	  DIM, DIM, CHECK_TILE, CHECK_TILE);
+
+  run_version ("seq", -1, timeout, &ref);
+  if (ref.frames < nb_frames)
+    exit_with_error ("Reference version seq failed at frame %u\n", ref.frames);
+
+  ref_dumps = calloc (nb_frames, sizeof (struct run));
+
+  for (unsigned i = 0; i < nv; i++) {
+    struct run r;
+
+    if (!strcmp (versions [i], "seq"))
+      continue;
+
+    run_version (versions [i], -1, timeout, &r);
+    failed += check_compare (versions [i], &ref, &r, ref_dumps, timeout);
+    free_run (&r);
+  }
+
+  if (failed)
+    printf ("%d version%s failed or differ%s from seq\n", failed, failed > 1 ? "s" : "", failed > 1 ? "" : "s");
+  else
+    printf ("All versions match seq\n");
+
+  for (unsigned f = 0; f < nb_frames; f++)
+    if (ref_dumps [f].frame != NULL)
+      free_run (&ref_dumps [f]);
+  free (ref_dumps);
+  free_run (&ref);
+
+  for (unsigned i = 0; i < nv; i++)
+    free (versions [i]);
+
+  return failed;
+}
@@ -0,0 +1,41 @@
+
+#include <string.h>
+
+#include "global.h"
+#include "graphics.h"
+#include "first_touch.h"
+
+void first_touch_region (int i_d, int j_d, int i_f, int j_f)
+{
+  size_t w = j_f - j_d + 1;
+
+  for (int i = i_d; i <= i_f; i++) {
+    memset (img_cell (image, i, j_d), 0, w * sizeof (Uint32));
+    if (alt_image != NULL)
+      memset (img_cell (alt_image, i, j_d), 0, w * sizeof (Uint32));
+    if (index_image != NULL)
+      memset (&cur_idx (i, j_d), 0, w * sizeof (Uint8));
+  }
+}
+
+void first_touch_rows (unsigned chunk)
+{
+  if (chunk == 0) {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < DIM; i++)
+      first_touch_region (i, 0, i, DIM - 1);
+  } else {
+    #pragma omp parallel for schedule(static, chunk)
+    for (int i = 0; i < DIM; i++)
+      first_touch_region (i, 0, i, DIM - 1);
+  }
+}
+
+void first_touch_tiles (unsigned grain, unsigned chunk)
+{
+  #pragma omp parallel for collapse(2) schedule(static, chunk)
+  for (int i = 0; i < grain; i++)
+    for (int j = 0; j < grain; j++)
+      first_touch_region ((long) i * DIM / grain, (long) j * DIM / grain,
+			  (long) (i + 1) * DIM / grain - 1, (long) (j + 1) * DIM / grain - 1);
+}
@@ -0,0 +1,284 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "constants.h"
+#include "global.h"
+#include "compute.h"
+#include "error.h"
+#include "debug.h"
+#include "gigapixel.h"
+
+#define GIGA_MAGIC "PAPGIGA1"
+
+char *gigapixel_file = NULL;
+
+// Organisation du fichier :
+//
+//   [en-tête (une page)] [un octet "fait" par tuile du niveau 0]
+//   [tuiles du niveau 0] [tuiles du niveau 1] ... [tuiles du dernier niveau]
+//
+// Chaque tuile occupe GIGA_TILE x GIGA_TILE pixels contigus ; les tuiles
+// d'un niveau sont rangées ligne par ligne. Le niveau k a un côté de
+// ceil (dim / 2^k) pixels.
+struct giga_header {
+  char magic [8];
+  uint64_t dim;
+  uint32_t tile;
+  uint32_t levels;
+  uint64_t done_offset;
+  uint64_t level_dim [GIGA_MAX_LEVELS];
+  uint64_t level_tiles [GIGA_MAX_LEVELS]; // nombre de tuiles par côté
+  uint64_t level_offset [GIGA_MAX_LEVELS];
+  uint64_t file_size;
+};
+
+static size_t page_size;
+static uint8_t *base = NULL;
+static struct giga_header *hdr = NULL;
+static uint8_t *done = NULL;
+
+// Nombre de tuiles du niveau 0 restant à calculer sous chaque tuile des
+// niveaux supérieurs : à zéro, la tuile est complète et peut quitter la RAM
+static uint32_t *pending [GIGA_MAX_LEVELS];
+
+static uint64_t round_up (uint64_t x, uint64_t a)
+{
+  return (x + a - 1) / a * a;
+}
+
+static void giga_layout (struct giga_header *h, uint64_t dim, unsigned tile)
+{
+  uint64_t off;
+
+  memset (h, 0, sizeof (*h));
+  memcpy (h->magic, GIGA_MAGIC, 8);
+  h->dim = dim;
+  h->tile = tile;
+
+  // On s'arrête dès qu'un niveau tient dans une seule tuile
+  for (h->levels = 0; h->levels < GIGA_MAX_LEVELS && (tile >> h->levels) > 0; h->levels++) {
+    unsigned k = h->levels;
+
+    if (k > 0 && h->level_dim [k - 1] <= tile)
+      break;
+    h->level_dim [k] = (dim + (1UL << k) - 1) >> k;
+    h->level_tiles [k] = (h->level_dim [k] + tile - 1) / tile;
+  }
+
+  h->done_offset = page_size;
+  off = round_up (h->done_offset + h->level_tiles [0] * h->level_tiles [0], page_size);
+
+  for (unsigned k = 0; k < h->levels; k++) {
+    h->level_offset [k] = off;
+    off += h->level_tiles [k] * h->level_tiles [k] * tile * tile * sizeof (uint32_t);
+  }
+  h->file_size = off;
+}
+
+static inline uint32_t *giga_tile (unsigned k, uint64_t ty, uint64_t tx)
+{
+  uint64_t t = ty * hdr->level_tiles [k] + tx;
+
+  return (uint32_t *)(base + hdr->level_offset [k])
+    + t * hdr->tile * hdr->tile;
+}
+
+// Écrit la zone sur disque et, si drop, la retire de l'ensemble résident
+static void giga_flush (void *addr, size_t len, int drop)
+{
+  uintptr_t start = (uintptr_t) addr & ~(page_size - 1);
+  uintptr_t end = round_up ((uintptr_t) addr + len, page_size);
+
+  if (msync ((void *) start, end - start, MS_SYNC) < 0)
+    perror ("msync");
+  if (drop)
+    madvise ((void *) start, end - start, MADV_DONTNEED);
+}
+
+static inline uint32_t avg4 (uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+  uint32_t r = 0;
+
+  for (int sh = 0; sh < 32; sh += 8) {
+    uint32_t s = ((a >> sh) & 0xFF) + ((b >> sh) & 0xFF)
+      + ((c >> sh) & 0xFF) + ((d >> sh) & 0xFF);
+    r |= ((s + 2) >> 2) << sh;
+  }
+  return r;
+}
+
+// Réduit la zone s x s de src en une zone s/2 x s/2 dans dst (pitch = tuile)
+static void giga_downsample (uint32_t *src, uint32_t *dst, unsigned s)
+{
+  const unsigned T = hdr->tile;
+
+  for (unsigned i = 0; i < s / 2; i++)
+    for (unsigned j = 0; j < s / 2; j++) {
+      uint32_t *p = src + (size_t) 2 * i * T + 2 * j;
+      dst [(size_t) i * T + j] = avg4 (p [0], p [1], p [T], p [T + 1]);
+    }
+}
+
+static void giga_render_tile (uint64_t ty, uint64_t tx)
+{
+  const unsigned T = hdr->tile;
+  uint64_t dim = hdr->dim;
+  unsigned h = MIN (T, dim - ty * T);
+  unsigned w = MIN (T, dim - tx * T);
+  uint32_t *t = giga_tile (0, ty, tx);
+  uint32_t *src = t;
+
+  PRINT_DEBUG ('g', "gigapixel: tuile (%lu, %lu)\n", ty, tx);
+
+  the_tile (t, T, ty * T, tx * T, h, w, dim);
+
+  // On alimente au passage la pyramide : la tuile (ty, tx) correspond à
+  // une zone de (T >> k) pixels de côté dans la tuile (ty >> k, tx >> k)
+  // du niveau k, disjointe des zones alimentées par les autres tuiles
+  for (unsigned k = 1, s = T; k < hdr->levels; k++, s /= 2) {
+    uint64_t m = (1UL << k) - 1;
+    uint32_t *dst = giga_tile (k, ty >> k, tx >> k)
+      + (ty & m) * (T >> k) * T + (tx & m) * (T >> k);
+
+    giga_downsample (src, dst, s);
+    giga_flush (dst, ((size_t) (s / 2 - 1) * T + s / 2) * sizeof (uint32_t), 0);
+    src = dst;
+  }
+
+  giga_flush (t, (size_t) T * T * sizeof (uint32_t), 1);
+
+  done [ty * hdr->level_tiles [0] + tx] = 1;
+
+  for (unsigned k = 1; k < hdr->levels; k++) {
+    uint64_t p = (ty >> k) * hdr->level_tiles [k] + (tx >> k);
+
+    if (__atomic_sub_fetch (&pending [k][p], 1, __ATOMIC_ACQ_REL) == 0)
+      giga_flush (giga_tile (k, ty >> k, tx >> k), (size_t) T * T * sizeof (uint32_t), 1);
+  }
+}
+
+// Extrait les bits pairs de m : parcours des tuiles en ordre de Morton,
+// pour que les tuiles des niveaux supérieurs se terminent au plus tôt
+static inline uint64_t morton_compact (uint64_t m)
+{
+  m &= 0x5555555555555555UL;
+  m = (m | (m >> 1)) & 0x3333333333333333UL;
+  m = (m | (m >> 2)) & 0x0F0F0F0F0F0F0F0FUL;
+  m = (m | (m >> 4)) & 0x00FF00FF00FF00FFUL;
+  m = (m | (m >> 8)) & 0x0000FFFF0000FFFFUL;
+  m = (m | (m >> 16)) & 0x00000000FFFFFFFFUL;
+  return m;
+}
+
+static void giga_open (char *filename, uint64_t dim)
+{
+  struct giga_header wanted;
+  struct stat sb;
+  int fd;
+
+  giga_layout (&wanted, dim, GIGA_TILE);
+
+  fd = open (filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    exit_with_error ("Cannot open %s\n", filename);
+
+  if (fstat (fd, &sb) < 0)
+    exit_with_error ("Cannot stat %s\n", filename);
+
+  if (sb.st_size == 0) {
+    // Fichier creux : seules les pages écrites occupent le disque
+    if (ftruncate (fd, wanted.file_size) < 0)
+      exit_with_error ("Cannot resize %s to %lu bytes\n", filename, wanted.file_size);
+  } else if (sb.st_size != wanted.file_size)
+    exit_with_error ("%s exists but does not match a %lux%lu image\n", filename, dim, dim);
+
+  base = mmap (NULL, wanted.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    exit_with_error ("Cannot map %s\n", filename);
+  close (fd);
+
+  hdr = (struct giga_header *) base;
+
+  if (sb.st_size == 0)
+    *hdr = wanted;
+  else if (memcmp (hdr, &wanted, sizeof (wanted)))
+    exit_with_error ("%s exists but does not match a %lux%lu image\n", filename, dim, dim);
+  else
+    printf ("Resuming gigapixel rendering from %s\n", filename);
+
+  done = base + hdr->done_offset;
+}
+
+void gigapixel_render (char *filename)
+{
+  uint64_t n, side, todo = 0, count = 0;
+  unsigned long temps;
+  struct timeval t1, t2;
+
+  if (the_tile == NULL)
+    exit_with_error ("Current kernel has no tile function: gigapixel mode unavailable\n");
+
+  if (DIM == 0)
+    DIM = DEFAULT_DIM;
+
+  page_size = sysconf (_SC_PAGESIZE);
+
+  giga_open (filename, DIM);
+
+  n = hdr->level_tiles [0];
+
+  for (unsigned k = 1; k < hdr->levels; k++)
+    pending [k] = calloc (hdr->level_tiles [k] * hdr->level_tiles [k], sizeof (uint32_t));
+
+  for (uint64_t ty = 0; ty < n; ty++)
+    for (uint64_t tx = 0; tx < n; tx++)
+      if (!done [ty * n + tx]) {
+	todo++;
+	for (unsigned k = 1; k < hdr->levels; k++)
+	  pending [k][(ty >> k) * hdr->level_tiles [k] + (tx >> k)]++;
+      }
+
+  printf ("Gigapixel image %ux%u: %lu tiles of %dx%d, %u levels, %lu tiles to compute\n",
+	  DIM, DIM, n * n, GIGA_TILE, GIGA_TILE, hdr->levels, todo);
+
+  for (side = 1; side < n; side <<= 1)
+    ;
+
+  gettimeofday (&t1, NULL);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (uint64_t m = 0; m < side * side; m++) {
+    uint64_t tx = morton_compact (m);
+    uint64_t ty = morton_compact (m >> 1);
+
+    if (tx >= n || ty >= n || done [ty * n + tx])
+      continue;
+
+    giga_render_tile (ty, tx);
+
+    uint64_t c = __atomic_add_fetch (&count, 1, __ATOMIC_RELAXED);
+    if (c * 100 / todo != (c - 1) * 100 / todo)
+      fprintf (stderr, "\r %lu%% (%lu/%lu tuiles)", c * 100 / todo, c, todo);
+  }
+
+  msync (base, hdr->file_size, MS_SYNC);
+
+  gettimeofday (&t2, NULL);
+
+  temps = (t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_usec - t1.tv_usec);
+  printf ("\nGigapixel rendering done: %lu tiles in %ld.%03ld ms\n",
+	  count, temps / 1000, temps % 1000);
+
+  for (unsigned k = 1; k < hdr->levels; k++)
+    free (pending [k]);
+
+  munmap (base, hdr->file_size);
+}
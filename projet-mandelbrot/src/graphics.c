@@ -10,6 +10,10 @@
 #include "error.h"
 #include "debug.h"
 #include "ocl.h"
+#include "timing.h"
+#include "latency.h"
+#include "registry.h"
+#include "overlay.h"
 
 static SDL_Window *win = NULL;
 static SDL_Renderer *ren = NULL;
@@ -23,10 +27,32 @@ unsigned display = 1;
 unsigned vsync = 1;
 unsigned do_first_touch = 0;
 unsigned do_random = 0;
+unsigned full_upload = 0;
+unsigned indexed_display = 0;
 
 Uint32 *image = NULL, *alt_image = NULL;
 unsigned DIM = 0;
 
+unsigned dirty_tracking = 0;
+unsigned dirty_ntiles = 0;
+unsigned char *dirty_tiles = NULL;
+
+// Lorsque DIM dépasse largement la taille de la fenêtre, l'image est
+// réduite (moyenne de blocs downscale x downscale) avant transfert, dans
+// une texture de tex_dim x tex_dim
+static unsigned downscale = 1;
+static unsigned tex_dim = 0;
+static Uint32 *reduced = NULL;
+
+Uint8 *index_image = NULL;
+static Uint32 palette [256];
+static unsigned palette_size = 0;
+static int palette_changed = 0;
+static int pixel_map_ok = -1;
+
+static unsigned long upload_bytes = 0;
+static unsigned long upload_frames = 0;
+
 
 static void graphics_create_surface (unsigned dim)
 {
@@ -38,8 +64,23 @@ static void graphics_create_surface (unsigned dim)
   amask = 0x000000ff;
 
   DIM = dim;
-  image = malloc (dim * dim * sizeof (Uint32));
-  alt_image = malloc (dim * dim * sizeof (Uint32));
+  dirty_ntiles = (dim + DIRTY_TILE - 1) / DIRTY_TILE;
+  dirty_tiles = malloc (dirty_ntiles * dirty_ntiles);
+  graphics_mark_all_dirty ();
+
+  image = malloc ((size_t) dim * dim * sizeof (Uint32));
+
+  // Allouée ici pour que le premier accès la place aussi
+  if (the_version->flags & VERSION_DOUBLE_BUFFER)
+    alt_image = malloc ((size_t) dim * dim * sizeof (Uint32));
+
+  if (indexed_display) {
+    if (palette_size > 0 && (the_version->flags & VERSION_INDEXED) && !opencl_used) {
+      printf ("Using indexed display (%d colors)\n", palette_size);
+      index_image = calloc ((size_t) dim * dim, sizeof (Uint8));
+    } else
+      printf ("*** Sorry, no indexed display for current version ***\n");
+  }
 
   if (do_first_touch) {
     if (the_first_touch != NULL) {
@@ -126,7 +167,7 @@ void graphics_init ()
   if (pngfile == NULL) {
     unsigned size = DIM ? DIM : DEFAULT_DIM;
     graphics_create_surface (size);
-    memset (image, 0, DIM * DIM * sizeof (Uint32));
+    memset (image, 0, (size_t) DIM * DIM * sizeof (Uint32));
     // FIXME: add an option to choose between life, spirals, etc.
     /*
     if (!do_random)
@@ -139,15 +180,36 @@ void graphics_init ()
 
   graphics_image_init ();
 
-  memcpy (alt_image, image, DIM * DIM * sizeof (Uint32));
+  // Seules les versions à double tampon paient la seconde image
+  if (alt_image != NULL)
+    memcpy (alt_image, image, (size_t) DIM * DIM * sizeof (Uint32));
+
+  // La texture partagée avec OpenCL doit garder la taille de l'image
+  if (display && !opencl_used && !full_upload && DIM / WIN_WIDTH >= 2) {
+    downscale = DIM / WIN_WIDTH;
+    tex_dim = DIM / downscale;
+    reduced = malloc ((size_t) tex_dim * tex_dim * sizeof (Uint32));
+    printf ("Downscaling image by %d before upload (%dx%d texture)\n",
+	    downscale, tex_dim, tex_dim);
+  } else
+    tex_dim = DIM;
 
   // Création d'une texture à partir de la surface
   //texture = SDL_CreateTextureFromSurface (ren, surface);
   texture = SDL_CreateTexture (ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
-			       DIM, DIM);
+			       tex_dim, tex_dim);
   PRINT_DEBUG ('g', "DIM = %d\n", DIM);
 }
 
+void graphics_alloc_alt_image (void)
+{
+  if (image == NULL || alt_image != NULL)
+    return;
+
+  alt_image = malloc ((size_t) DIM * DIM * sizeof (Uint32));
+  memcpy (alt_image, image, (size_t) DIM * DIM * sizeof (Uint32));
+}
+
 void graphics_share_texture_buffers (void)
 {
   GLuint texid;
@@ -159,9 +221,196 @@ void graphics_share_texture_buffers (void)
   ocl_map_textures (texid);
 }
 
+void graphics_set_palette (Uint32 *colors, unsigned n)
+{
+  if (n > 256)
+    exit_with_error ("Palette too large (%d colors)\n", n);
+
+  memcpy (palette, colors, n * sizeof (Uint32));
+  palette_size = n;
+  palette_changed = 1;
+
+  // Les couleurs sont appliquées au transfert : tout est à renvoyer
+  if (dirty_tiles != NULL)
+    graphics_mark_all_dirty ();
+}
+
+void graphics_mark_all_dirty (void)
+{
+  memset (dirty_tiles, 1, dirty_ntiles * dirty_ntiles);
+}
+
+// Regroupe les tuiles modifiées en rectangles (extension gloutonne vers la
+// droite puis vers le bas), remet le bitmap à zéro et appelle fun sur
+// chaque rectangle. Renvoie le nombre de pixels couverts.
+static unsigned long graphics_for_each_dirty_rect (void (*fun) (SDL_Rect *))
+{
+  const unsigned n = dirty_ntiles;
+  unsigned long pixels = 0;
+  unsigned nb_rects = 0;
+
+  for (unsigned i = 0; i < n; i++)
+    for (unsigned j = 0; j < n; j++)
+      if (dirty_tiles [i * n + j]) {
+	unsigned i2 = i, j2 = j;
+	SDL_Rect r;
+
+	while (j2 + 1 < n && dirty_tiles [i * n + j2 + 1])
+	  j2++;
+
+	for (int full = 1; full && i2 + 1 < n; ) {
+	  for (unsigned jj = j; jj <= j2; jj++)
+	    if (!dirty_tiles [(i2 + 1) * n + jj]) {
+	      full = 0;
+	      break;
+	    }
+	  if (full)
+	    i2++;
+	}
+
+	for (unsigned ii = i; ii <= i2; ii++)
+	  memset (&dirty_tiles [ii * n + j], 0, j2 - j + 1);
+
+	r.x = j * DIRTY_TILE;
+	r.y = i * DIRTY_TILE;
+	r.w = MIN (DIM, (j2 + 1) * DIRTY_TILE) - r.x;
+	r.h = MIN (DIM, (i2 + 1) * DIRTY_TILE) - r.y;
+
+	fun (&r);
+	pixels += (unsigned long) r.w * r.h;
+	nb_rects++;
+      }
+
+  PRINT_DEBUG ('g', "%u dirty rectangle(s), %lu pixels\n", nb_rects, pixels);
+
+  return pixels;
+}
+
+static void upload_rect (SDL_Rect *r)
+{
+  glTexSubImage2D (GL_TEXTURE_2D,
+		   0, /* mipmap level */
+		   r->x, r->y, /* x, y */
+		   r->w, r->h, /* width, height */
+		   GL_RGBA,
+		   GL_UNSIGNED_INT_8_8_8_8,
+		   img_cell (image, r->y, r->x));
+
+  upload_bytes += (unsigned long) r->w * r->h * sizeof (Uint32);
+}
+
+// Réduit puis transfère la zone r de l'image (coordonnées dans image).
+// Chaque pixel réduit est la moyenne, canal par canal, d'un bloc
+// downscale x downscale. Les canaux étant indépendants, on travaille sur
+// les octets : les lignes du bloc sont d'abord cumulées (accès contigus,
+// vectorisés), puis les colonnes, sur une ligne f fois plus courte.
+static void downscale_rect (SDL_Rect *r)
+{
+  const unsigned f = downscale;
+  const unsigned norm = f * f;
+  unsigned r0 = r->y / f, r1 = MIN (tex_dim, (r->y + r->h + f - 1) / f);
+  unsigned c0 = r->x / f, c1 = MIN (tex_dim, (r->x + r->w + f - 1) / f);
+  unsigned w = (c1 - c0) * 4;
+
+#pragma omp parallel
+  {
+    // Sur le tas : 16 x DIM octets par thread dépasseraient la pile des
+    // threads OpenMP (OMP_STACKSIZE) sur les très grandes images
+    unsigned *acc = malloc ((size_t) w * f * sizeof (unsigned));
+
+#pragma omp for schedule(static)
+    for (unsigned i = r0; i < r1; i++) {
+      Uint8 *dst = (Uint8 *) (reduced + (size_t) i * tex_dim + c0);
+
+      memset (acc, 0, (size_t) w * f * sizeof (unsigned));
+
+      for (unsigned k = 0; k < f; k++) {
+	Uint8 *src = (Uint8 *) img_cell (image, i * f + k, c0 * f);
+
+#pragma omp simd
+	for (unsigned x = 0; x < w * f; x++)
+	  acc [x] += src [x];
+      }
+
+      for (unsigned x = 0; x < w; x += 4)
+	for (unsigned ch = 0; ch < 4; ch++) {
+	  unsigned sum = 0;
+
+	  for (unsigned l = 0; l < f; l++)
+	    sum += acc [x * f + l * 4 + ch];
+	  dst [x + ch] = sum / norm;
+	}
+    }
+
+    free (acc);
+  }
+
+  glTexSubImage2D (GL_TEXTURE_2D,
+		   0, /* mipmap level */
+		   c0, r0, /* x, y */
+		   c1 - c0, r1 - r0, /* width, height */
+		   GL_RGBA,
+		   GL_UNSIGNED_INT_8_8_8_8,
+		   reduced + (size_t) r0 * tex_dim + c0);
+
+  upload_bytes += (unsigned long) (c1 - c0) * (r1 - r0) * sizeof (Uint32);
+}
+
+// Transfert des indices : la table de correspondance (pixel map) d'OpenGL
+// convertit chaque indice en couleur RGBA lors de l'écriture dans la
+// texture, soit 1 octet transféré par pixel au lieu de 4
+static void upload_index_rect (SDL_Rect *r)
+{
+  glTexSubImage2D (GL_TEXTURE_2D,
+		   0, /* mipmap level */
+		   r->x, r->y, /* x, y */
+		   r->w, r->h, /* width, height */
+		   GL_COLOR_INDEX,
+		   GL_UNSIGNED_BYTE,
+		   &cur_idx (r->y, r->x));
+
+  upload_bytes += (unsigned long) r->w * r->h * sizeof (Uint8);
+}
+
+static void load_pixel_maps (void)
+{
+  GLfloat map [4][256];
+
+  for (unsigned i = 0; i < 256; i++)
+    for (unsigned ch = 0; ch < 4; ch++)
+      map [ch][i] = (i < palette_size)
+	? ((palette [i] >> (24 - 8 * ch)) & 0xFF) / 255.0f : 0.0f;
+
+  glPixelMapfv (GL_PIXEL_MAP_I_TO_R, 256, map [0]);
+  glPixelMapfv (GL_PIXEL_MAP_I_TO_G, 256, map [1]);
+  glPixelMapfv (GL_PIXEL_MAP_I_TO_B, 256, map [2]);
+  glPixelMapfv (GL_PIXEL_MAP_I_TO_A, 256, map [3]);
+
+  palette_changed = 0;
+}
+
+// Sans pixel map utilisable (ou avec réduction), la palette est appliquée
+// sur le CPU avant le transfert habituel
+static void colorize_rect (SDL_Rect *r)
+{
+#pragma omp parallel for schedule(static)
+  for (int i = r->y; i < r->y + r->h; i++)
+    for (int j = r->x; j < r->x + r->w; j++)
+      cur_img (i, j) = palette [cur_idx (i, j)];
+
+  if (downscale > 1)
+    downscale_rect (r);
+  else
+    upload_rect (r);
+}
+
+// Fin de l'envoi de la texture : début de la phase d'affichage
+static uint64_t render_start = 0;
+
 void graphics_render_image (void)
 {
   SDL_Rect src, dst;
+  uint64_t start = latency_enabled ? timing_stamp () : 0;
 
   // Refresh texture
   if (opencl_used) {
@@ -170,21 +419,61 @@ void graphics_render_image (void)
     ocl_update_texture ();
 
   } else {
+    void (*upload) (SDL_Rect *) = (downscale > 1) ? downscale_rect : upload_rect;
+    unsigned long before = upload_bytes;
+    int map_color = 0;
+
     SDL_GL_BindTexture (texture, NULL, NULL);
 
-    glTexSubImage2D (GL_TEXTURE_2D,
-		     0, /* mipmap level */
-		     0, 0, /* x, y */
-		     DIM, DIM, /* width, height */
-		     GL_RGBA,
-		     GL_UNSIGNED_INT_8_8_8_8,
-		     image);
+    if (index_image != NULL) {
+      if (pixel_map_ok == -1) {
+	GLint max = 0;
+
+	glGetIntegerv (GL_MAX_PIXEL_MAP_TABLE, &max);
+	pixel_map_ok = (max >= 256);
+	PRINT_DEBUG ('g', "GL_MAX_PIXEL_MAP_TABLE = %d\n", max);
+      }
+
+      if (pixel_map_ok && downscale == 1) {
+	if (palette_changed)
+	  load_pixel_maps ();
+	glPixelTransferi (GL_MAP_COLOR, GL_TRUE);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+	upload = upload_index_rect;
+	map_color = 1;
+      } else
+	upload = colorize_rect;
+    }
+
+    glPixelStorei (GL_UNPACK_ROW_LENGTH, (downscale > 1) ? tex_dim : DIM);
+
+    if (dirty_tracking)
+      graphics_for_each_dirty_rect (upload);
+    else {
+      SDL_Rect all = { 0, 0, DIM, DIM };
+      upload (&all);
+    }
+
+    glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+
+    if (map_color) {
+      glPixelTransferi (GL_MAP_COLOR, GL_FALSE);
+      glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    upload_frames++;
+    PRINT_DEBUG ('g', "Texture upload: %lu bytes\n", upload_bytes - before);
+  }
+
+  if (latency_enabled) {
+    render_start = timing_stamp ();
+    latency_record (PHASE_COLORIZE, timing_ns (start, render_start));
   }
   
   src.x = 0;
   src.y = 0;
-  src.w = DIM;
-  src.h = DIM;
+  src.w = tex_dim;
+  src.h = tex_dim;
 
   // On redimensionne l'image pour qu'elle occupe toute la fenêtre
   dst.x = 0;
@@ -193,6 +482,8 @@ void graphics_render_image (void)
   dst.h = WIN_HEIGHT;
 
   SDL_RenderCopy (ren, texture, &src, &dst);
+
+  overlay_draw (ren, WIN_WIDTH, WIN_HEIGHT);
 }
 
 void graphics_refresh (void)
@@ -205,10 +496,23 @@ void graphics_refresh (void)
   
   // Met à jour l'affichage sur écran
   SDL_RenderPresent (ren);
+
+  if (latency_enabled)
+    latency_record (PHASE_DISPLAY, timing_ns (render_start, timing_stamp ()));
 }
 
 void graphics_clean (void)
 {
+  if (upload_frames > 0)
+    printf ("Texture upload: %lu KiB per frame on average (%lu frames)\n",
+	    upload_bytes / upload_frames / 1024, upload_frames);
+
+  if (reduced != NULL)
+    free (reduced);
+
+  if (index_image != NULL)
+    free (index_image);
+
   if (display) {
     
     if (ren != NULL)
@@ -225,6 +529,9 @@ void graphics_clean (void)
   if (image != NULL)
     free (image);
 
+  if (dirty_tiles != NULL)
+    free (dirty_tiles);
+
   if (surface != NULL)
       SDL_FreeSurface (surface);
 
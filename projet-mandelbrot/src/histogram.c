@@ -0,0 +1,82 @@
+
+#include <string.h>
+
+#include "histogram.h"
+
+static inline unsigned bucket_of (uint64_t v)
+{
+  unsigned msb, shift;
+
+  if (v < 2 * HISTO_HALF)
+    return v;
+
+  msb = 63 - __builtin_clzll (v);
+  shift = msb - (HISTO_SUB_BITS - 1);
+
+  // (v >> shift) est dans [HISTO_HALF, 2 * HISTO_HALF[
+  return shift * HISTO_HALF + (v >> shift);
+}
+
+// Plus grande valeur rangée dans la case b
+static inline uint64_t bucket_top (unsigned b)
+{
+  unsigned shift;
+
+  if (b < 2 * HISTO_HALF)
+    return b;
+
+  shift = b / HISTO_HALF - 1;
+  return ((uint64_t) (b - shift * HISTO_HALF + 1) << shift) - 1;
+}
+
+void histogram_reset (histogram_t *h)
+{
+  memset (h, 0, sizeof (*h));
+  h->min = UINT64_MAX;
+}
+
+void histogram_record (histogram_t *h, uint64_t value)
+{
+  h->bucket [bucket_of (value)]++;
+  h->count++;
+  h->sum += value;
+  if (value < h->min)
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+}
+
+uint64_t histogram_percentile (histogram_t *h, double p)
+{
+  uint64_t rank, seen = 0;
+
+  if (h->count == 0)
+    return 0;
+
+  rank = (uint64_t) (p / 100.0 * h->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+
+  for (unsigned b = 0; b < HISTO_BUCKETS; b++) {
+    seen += h->bucket [b];
+    if (seen >= rank) {
+      uint64_t v = bucket_top (b);
+
+      return v < h->max ? v : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+void histogram_print (histogram_t *h, const char *name, FILE *f)
+{
+  if (h->count == 0)
+    return;
+
+  fprintf (f, "  %-10s n %-7lu mean %9.3f  p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms\n",
+	   name, (unsigned long) h->count, h->sum / h->count * 1e-6,
+	   histogram_percentile (h, 50) * 1e-6, histogram_percentile (h, 90) * 1e-6,
+	   histogram_percentile (h, 99) * 1e-6, histogram_percentile (h, 99.9) * 1e-6,
+	   h->max * 1e-6);
+}
@@ -0,0 +1,54 @@
+
+#include <stdio.h>
+
+#include "global.h"
+#include "compute.h"
+#include "debug.h"
+#include "timing.h"
+#include "histogram.h"
+#include "latency.h"
+
+unsigned latency_enabled = 0;
+
+static const char *phase_name [NB_PHASES] = { "compute", "colorize", "display", "input" };
+
+static histogram_t phase [NB_PHASES];
+static uint64_t first [NB_PHASES];
+static int seen [NB_PHASES];
+
+void latency_init (void)
+{
+  if (!debug_enabled ('t'))
+    return;
+
+  timing_init ();
+
+  for (int p = 0; p < NB_PHASES; p++)
+    histogram_reset (&phase [p]);
+
+  latency_enabled = 1;
+}
+
+void latency_record (int p, uint64_t ns)
+{
+  if (!seen [p]) {
+    first [p] = ns;
+    seen [p] = 1;
+  } else
+    histogram_record (&phase [p], ns);
+}
+
+void latency_report (const char *kernel)
+{
+  if (!latency_enabled)
+    return;
+
+  fprintf (stderr, "\nFrame latency, %s/%s (DIM %u, %s):\n", kernel, version, DIM,
+	   timing_tsc_ns > 0 ? "rdtsc" : "CLOCK_MONOTONIC");
+
+  for (int p = 0; p < NB_PHASES; p++)
+    if (seen [p]) {
+      histogram_print (&phase [p], phase_name [p], stderr);
+      fprintf (stderr, "  %-10s first frame %9.3f ms\n", "", first [p] * 1e-6);
+    }
+}
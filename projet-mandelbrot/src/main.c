@@ -12,6 +12,18 @@
 #include "debug.h"
 #include "ocl.h"
 #include "constants.h"
+#include "gigapixel.h"
+#include "tuning.h"
+#include "bench.h"
+#include "check.h"
+#include "perfctr.h"
+#include "timing.h"
+#include "latency.h"
+#include "registry.h"
+#include "plugin.h"
+#include "overlay.h"
+#include "view.h"
+#include "serve.h"
 
 #ifdef __APPLE__
 #define DLSYM_FLAG RTLD_SELF
@@ -25,6 +37,7 @@
 
 
 static char *progname = NULL;
+static char *kernel = NULL;
 
 int max_iter = 0;
 unsigned refresh_rate = 1;
@@ -33,6 +46,7 @@ void_func_t the_first_touch = NULL;
 void_func_t the_init = NULL;
 void_func_t the_finalize = NULL;
 int_func_t the_compute = NULL;
+tile_func_t the_tile = NULL;
 
 char *version = "seq";
 unsigned opencl_used = 0;
@@ -56,6 +70,9 @@ static void usage (int val)
   fprintf (stderr, "option can be:\n");
   fprintf (stderr, "\t-k\t| --kernel <name>\t: override KERNEL environment variable\n");
   fprintf (stderr, "\t-n\t| --no-display\t\t: avoid graphical display overhead\n");
+  fprintf (stderr, "\t-iz\t| --interactive\t\t: pan (drag) and zoom (wheel) with the mouse\n");
+  fprintf (stderr, "\t-fu\t| --full-upload\t\t: upload full-size images even if larger than the window\n");
+  fprintf (stderr, "\t-ix\t| --indexed\t\t: let the kernel produce palette indices instead of colors\n");
   fprintf (stderr, "\t-l\t| --load-image <file>\t: use PNG image <file>\n");
   fprintf (stderr, "\t-a\t| --alea\t\t: start from a randomized state\n");
   fprintf (stderr, "\t-s\t| --size <DIM>\t\t: use image of size DIM x DIM\n");
@@ -63,8 +80,19 @@ static void usage (int val)
   fprintf (stderr, "\t-r\t| --refresh-rate <N>\t: display only 1/Nth of images\n");
   fprintf (stderr, "\t-d\t| --debug-flags <flags>\t: enable debug messages\n");
   fprintf (stderr, "\t-v\t| --version <name>\t\t: select version <name> of algorithm\n");
+  fprintf (stderr, "\t-isa\t| --isa <level>\t\t: use the kernel plugin built for <level> (builtin: none)\n");
   fprintf (stderr, "\t-o\t| --ocl\t\t\t: use OpenCL version\n");
+  fprintf (stderr, "\t-op\t| --ocl-profile <file>\t: profile OpenCL commands, report to <file> (- for stderr)\n");
   fprintf (stderr, "\t-ft\t| --first-touch\t\t: touch memory on different cores\n");
+  fprintf (stderr, "\t-b\t| --bench <v1,v2,...|all>\t: benchmark versions (and seq) in one process\n");
+  fprintf (stderr, "\t-bt\t| --bench-threads <p1,p2,...>\t: thread counts for --bench\n");
+  fprintf (stderr, "\t-br\t| --bench-reps <n>\t: timed repetitions for --bench (default 5)\n");
+  fprintf (stderr, "\t-bw\t| --bench-warmup <n>\t: warmup repetitions for --bench (default 1)\n");
+  fprintf (stderr, "\t-bo\t| --bench-output <file>\t: --bench results as CSV, or JSON for *.json\n");
+  fprintf (stderr, "\t-ck\t| --check\t\t: compare the images of all versions with seq\n");
+  fprintf (stderr, "\t-at\t| --autotune\t\t: search the best tuning parameters and save them\n");
+  fprintf (stderr, "\t-g\t| --gigapixel <file>\t: render a DIM x DIM image tile by tile into <file>\n");
+  fprintf (stderr, "\t-sv\t| --serve <port|path>\t: serve tiles over HTTP on a localhost port or a Unix socket\n");
   fprintf (stderr, "\t-h\t| --help\t\t: display help\n");
 
   exit (val);
@@ -82,14 +110,76 @@ static void filter_args (int *argc, char *argv[])
       vsync = 0;
     } else if (!strcmp (*argv, "--no-display") || !strcmp (*argv, "-n")) {
       display = 0;
+    } else if (!strcmp (*argv, "--interactive") || !strcmp (*argv, "-iz")) {
+      do_interactive = 1;
+    } else if (!strcmp (*argv, "--full-upload") || !strcmp (*argv, "-fu")) {
+      full_upload = 1;
+    } else if (!strcmp (*argv, "--indexed") || !strcmp (*argv, "-ix")) {
+      indexed_display = 1;
     } else if(!strcmp (*argv, "--help") || !strcmp (*argv, "-h")) {
       usage (0);
     } else if (!strcmp (*argv, "--first-touch") || !strcmp (*argv, "-ft")) {
       do_first_touch = 1;
+    } else if (!strcmp (*argv, "--autotune") || !strcmp (*argv, "-at")) {
+      do_autotune = 1;
+      display = 0;
+    } else if (!strcmp (*argv, "--check") || !strcmp (*argv, "-ck")) {
+      do_check = 1;
+      display = 0;
+    } else if (!strcmp (*argv, "--bench") || !strcmp (*argv, "-b")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: version list missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      bench_versions = *argv;
+      display = 0;
+    } else if (!strcmp (*argv, "--bench-threads") || !strcmp (*argv, "-bt")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: thread list missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      bench_threads = *argv;
+    } else if (!strcmp (*argv, "--bench-reps") || !strcmp (*argv, "-br")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: N missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      bench_reps = atoi (*argv);
+    } else if (!strcmp (*argv, "--bench-warmup") || !strcmp (*argv, "-bw")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: N missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      bench_warmup = atoi (*argv);
+    } else if (!strcmp (*argv, "--bench-output") || !strcmp (*argv, "-bo")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: filename missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      bench_output = *argv;
     } else if (!strcmp (*argv, "--alea") || !strcmp (*argv, "-a")) {
       do_random = 1;
+    } else if (!strcmp (*argv, "--isa") || !strcmp (*argv, "-isa")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: ISA level missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      plugin_isa = *argv;
     } else if (!strcmp (*argv, "--ocl") || !strcmp (*argv, "-o")) {
       opencl_used = 1;
+    } else if (!strcmp (*argv, "--ocl-profile") || !strcmp (*argv, "-op")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: filename missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      ocl_profile_file = *argv;
     } else if (!strcmp (*argv, "--kernel") || !strcmp (*argv, "-k")) {
       if (*argc == 1) {
 	fprintf (stderr, "Error: kernel name missing\n");
@@ -104,6 +194,22 @@ static void filter_args (int *argc, char *argv[])
       }
       (*argc)--; argv++;
       pngfile = *argv;
+    } else if (!strcmp (*argv, "--gigapixel") || !strcmp (*argv, "-g")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: filename missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      gigapixel_file = *argv;
+      display = 0;
+    } else if (!strcmp (*argv, "--serve") || !strcmp (*argv, "-sv")) {
+      if (*argc == 1) {
+	fprintf (stderr, "Error: port or socket path missing\n");
+	usage (1);
+      }
+      (*argc)--; argv++;
+      serve_address = *argv;
+      display = 0;
     } else if (!strcmp (*argv, "--size") || !strcmp (*argv, "-s")) {
       if (*argc == 1) {
 	fprintf (stderr, "Error: DIM missing\n");
@@ -117,7 +223,7 @@ static void filter_args (int *argc, char *argv[])
 	usage (1);
       }
       (*argc)--; argv++;
-      if (!strcmp (*argv, "ocl"))
+      if (!strncmp (*argv, "ocl", 3))
 	opencl_used = 1;
       version = *argv;
     } else if (!strcmp (*argv, "--iterations") || !strcmp (*argv, "-i")) {
@@ -150,39 +256,87 @@ static void filter_args (int *argc, char *argv[])
   }
 }
 
-static void bind_functions (void)
+// Un appel à the_compute, encadré par les compteurs matériels (debug 'h')
+static unsigned compute (unsigned nb_iter)
 {
-  char *kernel = NULL;
+  unsigned n;
+
+  perfctr_begin ();
+  n = the_compute (nb_iter);
+  perfctr_end (n > 0 ? n : nb_iter);
+
+  return n;
+}
+
+// Noyau absent du registre : points d'entrée trouvés par leur nom
+// (<kernel>_compute_<version>, etc.), besoins supposés maximaux
+static void bind_symbols (void)
+{
+  static version_desc_t desc;
   char buffer [1024];
-  
-  kernel = getenv ("KERNEL");
-  if (kernel == NULL)
-    kernel = DEFAULT_KERNEL;
+
+  desc.name = version;
+  desc.flags = VERSION_DOUBLE_BUFFER | VERSION_INDEXED | VERSION_STABILIZES
+    | (opencl_used ? VERSION_OPENCL : 0);
 
   sprintf (buffer, "%s_compute_%s", kernel, version);
-  the_compute = dlsym (DLSYM_FLAG, buffer);
+  desc.compute = dlsym (DLSYM_FLAG, buffer);
 
-  if (the_compute == NULL) {
+  if (desc.compute == NULL) {
     if (opencl_used) {
       fprintf (stderr, "Warning: Cannot resolve symbol %s,\n", buffer);
       fprintf (stderr, "         => falling back to generic OpenCL kernel launcher!\n");
-      the_compute = ocl_compute;
+      desc.compute = ocl_compute;
     } else
       exit_with_error ("Cannot resolve symbol %s\n", buffer);
   }
 
-  printf ("Using kernel [%s], version %s\n", kernel, version);
-
   sprintf (buffer, "%s_init_%s", kernel, version);
-  the_init = dlsym (DLSYM_FLAG, buffer);
+  desc.init = dlsym (DLSYM_FLAG, buffer);
 
   sprintf (buffer, "%s_finalize_%s", kernel, version);
-  the_finalize = dlsym (DLSYM_FLAG, buffer);
+  desc.finalize = dlsym (DLSYM_FLAG, buffer);
 
-  if (!opencl_used) {
-    sprintf (buffer, "%s_ft_%s", kernel, version);
-    the_first_touch = dlsym (DLSYM_FLAG, buffer);
-  }
+  sprintf (buffer, "%s_ft_%s", kernel, version);
+  desc.first_touch = dlsym (DLSYM_FLAG, buffer);
+
+  sprintf (buffer, "%s_tile", kernel);
+  the_tile = dlsym (DLSYM_FLAG, buffer);
+
+  sprintf (buffer, "%s_tuning", kernel);
+  the_tuning = dlsym (DLSYM_FLAG, buffer);
+
+  the_version = &desc;
+}
+
+void bind_functions (void)
+{
+  kernel_desc_t *k;
+
+  kernel = getenv ("KERNEL");
+  if (kernel == NULL)
+    kernel = DEFAULT_KERNEL;
+
+  k = registry_kernel (kernel);
+  the_version = (k != NULL) ? registry_version (k, version) : NULL;
+
+  if (the_version != NULL) {
+    opencl_used = (the_version->flags & VERSION_OPENCL) != 0;
+    the_tile = k->tile;
+    the_tuning = k->tuning;
+  } else
+    bind_symbols ();
+
+  printf ("Using kernel [%s], version %s\n", kernel, version);
+
+  the_compute = the_version->compute;
+  the_init = the_version->init;
+  the_finalize = the_version->finalize;
+  the_first_touch = opencl_used ? NULL : the_version->first_touch;
+
+  // Changement de version après graphics_init (--bench, --check)
+  if (the_version->flags & VERSION_DOUBLE_BUFFER)
+    graphics_alloc_alt_image ();
 }
 
 int main (int argc, char **argv)
@@ -193,13 +347,60 @@ int main (int argc, char **argv)
 
   filter_args (&argc, argv);
 
+  perfctr_init ();
+  latency_init ();
+
+  // Avant bind_functions : le greffon remplace les versions de prog
+  plugin_load ();
+
   bind_functions ();
   
   if (the_init != NULL)
     the_init ();
 
+  if (gigapixel_file != NULL) {
+    // Ni fenêtre ni image en mémoire : rendu tuile par tuile dans le fichier
+    gigapixel_render (gigapixel_file);
+
+    if (the_finalize != NULL)
+      the_finalize ();
+
+    return 0;
+  }
+
+  if (serve_address != NULL) {
+    // Serveur de tuiles : pas d'image, chaque requête a sa propre taille
+    serve_run (serve_address);
+
+    if (the_finalize != NULL)
+      the_finalize ();
+
+    return 0;
+  }
+
+  // Réglage propre à cette machine, s'il y en a un : avant graphics_init,
+  // dont le premier accès (-ft) place les pages d'après grain, chunk...,
+  // et avant ocl_init, qui compile le programme OpenCL avec TILEX et
+  // TILEY. Le profil dépend de DIM, qu'une image (-l) ne donne qu'une
+  // fois chargée : elle est alors placée avec les valeurs par défaut
+  if (!do_autotune && pngfile == NULL) {
+    if (DIM == 0)
+      DIM = DEFAULT_DIM;
+    tuning_load_profile (kernel);
+  }
+
+  // L'aperçu de --interactive vient de the_tile, qui rend des couleurs :
+  // il n'apparaîtrait pas dans index_image
+  if (do_interactive && indexed_display) {
+    printf ("*** Sorry, no indexed display in interactive mode ***\n");
+    indexed_display = 0;
+  }
+
   graphics_init ();
   // Now we now the value of DIM
+
+  if (!do_autotune && pngfile != NULL)
+    tuning_load_profile (kernel);
   
   if (opencl_used) {
 
@@ -207,11 +408,35 @@ int main (int argc, char **argv)
     ocl_send_image (image);
   }
 
-  if (graphics_display_enabled ()) {
+  if (do_autotune || bench_versions != NULL || do_check) {
+    int status = 0;
+
+    if (do_autotune)
+      tuning_autotune (kernel);
+    else if (do_check)
+      status = check_run (kernel) ? EXIT_FAILURE : 0;
+    else
+      bench_run (kernel);
+
+    if (ocl_initialized)
+      ocl_profiling_report ();
+
+    graphics_clean ();
+
+    if (the_finalize != NULL)
+      the_finalize ();
+
+    return status;
+  }
+
+  if (do_interactive) {
+    kernel_desc_t *k = registry_kernel (kernel);
+
+    view_interactive (k != NULL ? k->navigate : NULL);
+  } else if (graphics_display_enabled ()) {
     // version graphique
 
     unsigned long temps = 0;
-    struct timeval t1, t2;
     
     if (opencl_used)
 	graphics_share_texture_buffers ();
@@ -254,6 +479,13 @@ int main (int argc, char **argv)
 	      update_refresh_rate(1);
 	      break;
 
+	    case SDLK_o :
+	      overlay_next_mode ();
+	      // Calcul terminé : l'image ne sera plus réaffichée sinon
+	      if (stable)
+		graphics_refresh ();
+	      break;
+
 	    default: ;
 	    }
 	    break ;
@@ -277,22 +509,25 @@ int main (int argc, char **argv)
 
 	  if (debug_enabled ('t')) {
 	    long duree_iteration;
+	    uint64_t s1, s2;
 
-	    gettimeofday (&t1, NULL);
-	    n = the_compute (refresh_rate);
+	    s1 = timing_stamp ();
+	    n = compute (refresh_rate);
 	    if (opencl_used)
 	      ocl_wait ();
-	    gettimeofday (&t2, NULL);
+	    s2 = timing_stamp ();
 
-	    duree_iteration = TIME_DIFF (t1,t2) ;
+	    duree_iteration = timing_ns (s1, s2) / 1000;
 	    temps += duree_iteration;
 	    int nbiter = (n > 0 ?  n : refresh_rate); 
+	    // Sur un lot de refresh_rate images, on compte la durée moyenne
+	    latency_record (PHASE_COMPUTE, timing_ns (s1, s2) / nbiter);
 	    fprintf (stderr,
 		     "\r dernière iteration  %ld.%03ld -  temps moyen par itération : %ld.%03ld ",
 		     duree_iteration/ nbiter / 1000, (duree_iteration/nbiter) % 1000 ,
 		     temps / 1000 / (nbiter+iterations) , (temps/(nbiter+iterations)) % 1000);	
 	  } else
-	    n = the_compute (refresh_rate);
+	    n = compute (refresh_rate);
 
 	  if (n > 0) {
 	    iterations += n;
@@ -315,6 +550,10 @@ int main (int argc, char **argv)
     unsigned long temps;
     struct timeval t1, t2;
     int n;
+
+    if (!max_iter && !(the_version->flags & VERSION_STABILIZES))
+      exit_with_error ("Version %s never stabilizes, set the number of iterations (-i)\n",
+		       version);
     
     gettimeofday (&t1, NULL);
 
@@ -323,7 +562,13 @@ int main (int argc, char **argv)
 	printf ("Arrêt après %d itérations\n", max_iter);
 	stable = 1;
       } else {
-	n = the_compute (refresh_rate);
+	uint64_t s1 = timing_stamp ();
+
+	n = compute (refresh_rate);
+	if (opencl_used)
+	  ocl_readback ();
+	if (latency_enabled)
+	  latency_record (PHASE_COMPUTE, timing_ns (s1, timing_stamp ()) / (n > 0 ? n : refresh_rate));
 	if (n > 0) {
 	  iterations += n;
 	  stable = 1;
@@ -333,8 +578,9 @@ int main (int argc, char **argv)
       }
     }
 
+    // Sans affichage, l'image finale est rapatriée dans image
     if (opencl_used)
-      ocl_wait ();
+      ocl_readback_flush ();
 
     gettimeofday (&t2, NULL);
     
@@ -342,6 +588,12 @@ int main (int argc, char **argv)
     fprintf (stderr, "%ld.%03ld\n", temps / 1000, temps % 1000);
   }
 
+  // hybrid initialise OpenCL sans être une version OpenCL
+  if (ocl_initialized)
+    ocl_profiling_report ();
+
+  latency_report (kernel);
+
   graphics_clean ();
 
   if (the_finalize != NULL)
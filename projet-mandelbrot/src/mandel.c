@@ -1,21 +1,36 @@
 
+#include "constants.h"
 #include "global.h"
 #include "compute.h"
 #include "graphics.h"
 #include "debug.h"
 #include "ocl.h"
 #include "scheduler.h"
+#include "tuning.h"
+#include "registry.h"
+#include "first_touch.h"
+#include "overlay.h"
+#include "view.h"
+#include "error.h"
 
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
 
 #define MAX_ITERATIONS 4096
 #define ZOOM_SPEED -0.01
 
-static unsigned iteration_to_color (unsigned iter)
+// Limite d'itérations de l'image en cours : MAX_ITERATIONS par défaut,
+// réglable par MANDEL_ITER (voir plus bas)
+static unsigned max_iterations = MAX_ITERATIONS;
+
+// Les points qui atteignent cap sont à l'intérieur de l'ensemble (noir)
+static unsigned iteration_to_color (unsigned iter, unsigned cap)
 {
   unsigned r = 0, g = 0, b = 0;
 
-  if (iter < MAX_ITERATIONS) {
+  if (iter < cap) {
     if (iter < 64) {
       r = iter * 2;    /* 0x0000 to 0x007E */
     } else if (iter < 128) {
@@ -42,6 +57,47 @@ static unsigned iteration_to_color (unsigned iter)
   return (r << 24) | (g << 16) | (b << 8) | 255 /* alpha */;
 }
 
+// Affichage indexé : les MAX_ITERATIONS + 1 valeurs possibles sont
+// regroupées en 256 bandes qui suivent les segments du dégradé de
+// iteration_to_color ; la bande 255 est réservée à l'intérieur (noir)
+static Uint8 iter_index [MAX_ITERATIONS + 1];
+
+static void mandel_build_palette (void)
+{
+  static const unsigned seg_start [] = { 0, 256, 512, 1024, 2048, MAX_ITERATIONS };
+  static const unsigned seg_bands [] = { 128, 31, 32, 32, 32 };
+  unsigned first [256], last [256];
+  Uint32 palette [256];
+  unsigned base = 0;
+
+  for (int s = 0; s < 5; s++) {
+    unsigned len = seg_start [s + 1] - seg_start [s];
+
+    for (unsigned iter = seg_start [s]; iter < seg_start [s + 1]; iter++)
+      iter_index [iter] = base + (iter - seg_start [s]) * seg_bands [s] / len;
+    base += seg_bands [s];
+  }
+  iter_index [MAX_ITERATIONS] = 255;
+
+  for (int iter = MAX_ITERATIONS; iter >= 0; iter--)
+    last [iter_index [iter]] = iter;
+  for (int iter = 0; iter <= MAX_ITERATIONS; iter++)
+    first [iter_index [iter]] = iter;
+
+  // Chaque bande prend la couleur de son itération médiane
+  for (int i = 0; i < 256; i++)
+    palette [i] = iteration_to_color ((first [i] + last [i]) / 2, MAX_ITERATIONS);
+
+  graphics_set_palette (palette, 256);
+}
+
+// Au-delà de MAX_ITERATIONS (limite adaptative), les points échappés
+// gardent la dernière bande du dégradé
+static inline Uint8 iteration_to_index (unsigned iter)
+{
+  return (iter < max_iterations) ? iter_index [MIN (iter, MAX_ITERATIONS - 1)] : 255;
+}
+
 
 // Cadre initial
 #if 1
@@ -68,8 +124,147 @@ static float bottomY = .64941;
 static float xstep;
 static float ystep;
 
+// Cadre piloté par l'utilisateur (--interactive) : plus de zoom automatique
+static int frozen = 0;
+
+///////////////////////////// Limite d'itérations adaptative (MANDEL_ITER)
+
+// MANDEL_ITER=<n> fixe la limite, MANDEL_ITER=adaptive la choisit à
+// chaque image d'après :
+//  - la profondeur du zoom (log2 du rapport entre la largeur de
+//    l'ensemble et celle du cadre), qui donne un plancher ;
+//  - les statistiques de l'image précédente, relevées sur un pixel sur
+//    ITER_SAMPLE x ITER_SAMPLE : proportion de points qui atteignent la
+//    limite, et distribution du nombre d'itérations des points échappés
+//    (histogramme par quarts d'octave).
+// La limite suivante vaut deux fois le 99,9e centile des points échappés,
+// sans jamais augmenter si aucun point n'atteint la limite (aucun détail
+// n'est alors perdu), ni baisser de plus de moitié d'une image à l'autre.
+// Le choix est affiché avec -d i. ocl et oclbatch, qui ne fournissent
+// pas de statistiques, n'utilisent que la profondeur ; hybrid n'échantillonne
+// que les lignes calculées sur le processeur. En mode adaptive, leurs
+// limites, donc leurs images, diffèrent de celles de seq (--check les
+// signale).
+
+#define ITERATIONS_MIN     256
+#define ITERATIONS_LIMIT   65536
+#define ITER_PER_DOUBLING  32
+#define ITER_SAMPLE        16
+#define ITER_BINS          (4 * 17)
+
+static int adaptive = 0;
+static unsigned iter_start = MAX_ITERATIONS; // limite de la première image
+static unsigned iter_hist [ITER_BINS];       // points échappés
+static unsigned iter_capped = 0;             // points qui atteignent la limite
+static unsigned iter_frame = 0;
+
+static void mandel_iter_init (void)
+{
+  char *str = getenv ("MANDEL_ITER");
+
+  if (str == NULL)
+    return;
+
+  if (!strcmp (str, "adaptive"))
+    adaptive = 1;
+  else {
+    int n = atoi (str);
+
+    if (n < 1 || n > ITERATIONS_LIMIT)
+      exit_with_error ("MANDEL_ITER must be 'adaptive' or a number in [1, %d]\n",
+		       ITERATIONS_LIMIT);
+    max_iterations = iter_start = n;
+  }
+}
+
+// Quart d'octave de iter + 1 : [2^e, 2^(e+1)[ est coupé en quatre
+static inline unsigned iter_bin (unsigned iter)
+{
+  unsigned v = iter + 1, e = 31 - __builtin_clz (v);
+
+  return 4 * e + (e >= 2 ? (v >> (e - 2)) & 3 : 0);
+}
+
+// Plus grand nombre d'itérations de la case b
+static inline unsigned iter_bin_last (unsigned b)
+{
+  unsigned e = b / 4, sub = b % 4;
+
+  return (e >= 2 ? ((5 + sub) << (e - 2)) : (2u << e)) - 2;
+}
+
+static inline void sample_iter (int i, int j, unsigned iter)
+{
+  if (!adaptive || ((i | j) & (ITER_SAMPLE - 1)))
+    return;
+
+  if (iter >= max_iterations)
+    __atomic_add_fetch (&iter_capped, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch (&iter_hist [iter_bin (iter)], 1, __ATOMIC_RELAXED);
+}
+
+// Appelé entre deux images (zoom), par un seul thread
+static void adapt_iterations (void)
+{
+  unsigned escaped = 0, q = 0, next;
+  double depth = log2 (3.0 / (rightX - leftX));
+
+  if (!adaptive)
+    return;
+
+  next = MIN (MAX (ITER_PER_DOUBLING * depth, ITERATIONS_MIN), ITERATIONS_LIMIT);
+
+  for (int b = 0; b < ITER_BINS; b++)
+    escaped += iter_hist [b];
+
+  if (escaped > 0) {
+    unsigned target = escaped - escaped / 1000, acc = 0, b;
+
+    for (b = 0; acc < target; b++)
+      acc += iter_hist [b];
+    q = iter_bin_last (b - 1);
+
+    if (iter_capped == 0)
+      next = MAX (next, MIN (2 * q, max_iterations));
+    else
+      next = MAX (next, 2 * q);
+  } else if (iter_capped > 0)
+    // Que des points intérieurs : rien à apprendre
+    next = MAX (next, max_iterations);
+
+  // Y compris sans statistiques (OpenCL) : au plus une division par deux
+  next = MAX (next, max_iterations / 2);
+  next = MIN (MAX (next, ITERATIONS_MIN), ITERATIONS_LIMIT);
+
+  PRINT_DEBUG ('i', "mandel: frame %u, depth %.1f, %.2f%% capped, p99.9 %u, cap %u -> %u\n",
+	       iter_frame, depth,
+	       (escaped + iter_capped) ? 100.0 * iter_capped / (escaped + iter_capped) : 0.0,
+	       q, max_iterations, next);
+
+  max_iterations = next;
+  iter_frame++;
+  iter_capped = 0;
+  memset (iter_hist, 0, sizeof (iter_hist));
+}
+
+static inline void store_pixel (int i, int j, unsigned iter)
+{
+  sample_iter (i, j, iter);
+
+  if (index_image != NULL)
+    cur_idx (i, j) = iteration_to_index (iter);
+  else
+    cur_img (i, j) = iteration_to_color (iter, max_iterations);
+}
+
 static void zoom (void)
 {
+  adapt_iterations ();
+
+  if (frozen)
+    return;
+
   float xrange = (rightX - leftX);
   float yrange = (topY - bottomY);
   
@@ -92,8 +287,8 @@ static unsigned compute_one_pixel (int i, int j)
   int iter;
 
   // Pour chaque pixel, on calcule les termes d'une suite, et on
-  // s'arrête lorsque |Z| > 2 ou lorsqu'on atteint MAX_ITERATIONS
-  for (iter = 0; iter < MAX_ITERATIONS; iter++) {
+  // s'arrête lorsque |Z| > 2 ou lorsqu'on atteint max_iterations
+  for (iter = 0; iter < max_iterations; iter++) {
     float x2 = x*x;
     float y2 = y*y;
 
@@ -110,6 +305,46 @@ static unsigned compute_one_pixel (int i, int j)
   return iter;
 }
 
+///////////////////////////// Rendu par tuiles d'une image virtuelle (gigapixel)
+
+// Même calcul que compute_one_pixel, mais en double précision : à 100k
+// pixels de côté, l'écart entre deux pixels voisins est sous la
+// précision des float
+static unsigned compute_one_point (double xc, double yc)
+{
+  double x = 0.0, y = 0.0;
+  int iter;
+
+  for (iter = 0; iter < max_iterations; iter++) {
+    double x2 = x*x;
+    double y2 = y*y;
+
+    if (x2 + y2 > 4.0)
+      break;
+
+    double twoxy = 2.0 * x * y;
+    x = x2 - y2 + xc;
+    y = twoxy + yc;
+  }
+
+  return iter;
+}
+
+// Le cadre courant est vu comme une image de dim x dim pixels
+void mandel_tile (unsigned *tile, unsigned pitch,
+		  unsigned long row, unsigned long col,
+		  unsigned h, unsigned w, unsigned long dim)
+{
+  double xs = ((double) rightX - leftX) / dim;
+  double ys = ((double) topY - bottomY) / dim;
+
+  for (unsigned i = 0; i < h; i++)
+    for (unsigned j = 0; j < w; j++)
+      tile [(size_t) i * pitch + j] =
+	iteration_to_color (compute_one_point (leftX + xs * (col + j),
+					       topY - ys * (row + i)), max_iterations);
+}
+
 ///////////////////////////// Version séquentielle simple (seq)
 
 
@@ -117,6 +352,19 @@ void mandel_init_seq ()
 {
   xstep = (rightX - leftX) / DIM;
   ystep = (topY - bottomY) / DIM;
+
+  mandel_build_palette ();
+  mandel_iter_init ();
+}
+
+void mandel_init_omps ()
+{
+  mandel_init_seq ();
+}
+
+void mandel_init_ompd ()
+{
+  mandel_init_seq ();
 }
 
 // Renvoie le nombre d'itérations effectuées avant stabilisation, ou 0
@@ -126,7 +374,7 @@ unsigned mandel_compute_seq (unsigned nb_iter)
 
     for (int i = 0; i < DIM; i++)
       for (int j = 0; j < DIM; j++)
-	cur_img (i, j) = iteration_to_color (compute_one_pixel (i, j));
+	store_pixel (i, j, compute_one_pixel (i, j));
 
     zoom ();
   }
@@ -134,16 +382,22 @@ unsigned mandel_compute_seq (unsigned nb_iter)
   return 0;
 }
 
+static unsigned omps_chunk = 1;
+static unsigned ompd_chunk = 2;
+
 unsigned mandel_compute_omps (unsigned nb_iter)
 {
   #pragma omp parallel
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
-    #pragma omp for schedule(static,1)
+    #pragma omp for schedule(static,omps_chunk)
     for (int i = 0; i < DIM; i++)
       for (int j = 0; j < DIM; j++)
-	cur_img (i, j) = iteration_to_color (compute_one_pixel (i, j));
+	store_pixel (i, j, compute_one_pixel (i, j));
 
+    // Un seul thread déplace le cadre ; la barrière implicite de single
+    // garantit que tous voient le nouveau cadre à l'image suivante
+    #pragma omp single
     zoom ();
   }
 
@@ -155,27 +409,59 @@ unsigned mandel_compute_ompd (unsigned nb_iter)
   #pragma omp parallel
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
-    #pragma omp for schedule(dynamic,2)
+    #pragma omp for schedule(dynamic,ompd_chunk)
     for (int i = 0; i < DIM; i++)
       for (int j = 0; j < DIM; j++)
-	cur_img (i, j) = iteration_to_color (compute_one_pixel (i, j));
+	store_pixel (i, j, compute_one_pixel (i, j));
 
+    #pragma omp single
     zoom ();
   }
 
   return 0;
 }
 
+// Premier accès (-ft) avec la répartition des lignes de omps et ompd ;
+// pour ompd, la distribution cyclique par paquets est la plus proche de
+// ce que fait schedule(dynamic) en régime établi
+static void mandel_ft_omps (void)
+{
+  first_touch_rows (omps_chunk);
+}
+
+static void mandel_ft_ompd (void)
+{
+  first_touch_rows (ompd_chunk);
+}
+
 ///////////////////////////// Version séquentielle tuilée (tiled)
 
-#define GRAIN 48
+static unsigned grain = 48;
+static unsigned omptiled_chunk = 2;
 
-static unsigned tranche = 0;
+// Début de la i-ème tranche de lignes (ou de colonnes) : les grain
+// tranches couvrent toute l'image, même si grain ne divise pas DIM
+static inline int tranche (int i)
+{
+  return (long) i * DIM / grain;
+}
 
 void mandel_init_tiled ()
 {
-  xstep = (rightX - leftX) / DIM;
-  ystep = (topY - bottomY) / DIM;
+  mandel_init_seq ();
+
+  // Chaque tuile calculée est signalée par traiter_tuile
+  dirty_tracking = 1;
+}
+
+void mandel_init_omptiled ()
+{
+  mandel_init_tiled ();
+}
+
+void mandel_init_omptask ()
+{
+  mandel_init_tiled ();
 }
 
 static void traiter_tuile (int i_d, int j_d, int i_f, int j_f)
@@ -184,22 +470,41 @@ static void traiter_tuile (int i_d, int j_d, int i_f, int j_f)
   
   for (int i = i_d; i <= i_f; i++)
     for (int j = j_d; j <= j_f; j++)
-	cur_img (i, j) = iteration_to_color (compute_one_pixel (i, j));
+	store_pixel (i, j, compute_one_pixel (i, j));
+
+  graphics_mark_dirty (i_d, j_d, i_f - i_d + 1, j_f - j_d + 1);
+}
+
+// worker : thread (ou ouvrier de sched) qui calcule la tuile, pour la
+// surimpression
+static void traiter_tuile_ij (int i, int j, unsigned worker)
+{
+  uint64_t start;
+
+  // Cadre abandonné (--interactive) : l'image en cours ne sera pas affichée
+  if (view_cancelled ())
+    return;
+
+  start = overlay_start ();
+
+  traiter_tuile (tranche (i) /* i debut */,
+		 tranche (j) /* j debut */,
+		 tranche (i + 1) - 1 /* i fin */,
+		 tranche (j + 1) - 1 /* j fin */);
+
+  overlay_record (i, j, start, worker);
 }
 
 unsigned mandel_compute_tiled (unsigned nb_iter)
 {
-  tranche = DIM / GRAIN;
-  
+  overlay_begin (grain);
+
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
     // On itére sur les coordonnées des tuiles
-    for (int i=0; i < GRAIN; i++)
-      for (int j=0; j < GRAIN; j++)
-	traiter_tuile (i * tranche /* i debut */,
-		       j * tranche /* j debut */,
-		       (i + 1) * tranche - 1 /* i fin */,
-		       (j + 1) * tranche - 1 /* j fin */);
+    for (int i=0; i < grain; i++)
+      for (int j=0; j < grain; j++)
+	traiter_tuile_ij (i, j, 0);
 
     zoom ();
   }
@@ -209,20 +514,17 @@ unsigned mandel_compute_tiled (unsigned nb_iter)
 
 unsigned mandel_compute_omptiled (unsigned nb_iter)
 {
-  tranche = DIM / GRAIN;
-  
+  overlay_begin (grain);
+
   //#pragma omp parallel
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
     #pragma omp parallel
     // On itére sur les coordonnées des tuiles
-    #pragma omp for collapse(2) schedule(dynamic,2)
-    for (int i=0; i < GRAIN; i++)
-      for (int j=0; j < GRAIN; j++)
-	traiter_tuile (i * tranche /* i debut */,
-		       j * tranche /* j debut */,
-		       (i + 1) * tranche - 1 /* i fin */,
-		       (j + 1) * tranche - 1 /* j fin */);
+    #pragma omp for collapse(2) schedule(dynamic,omptiled_chunk)
+    for (int i=0; i < grain; i++)
+      for (int j=0; j < grain; j++)
+	traiter_tuile_ij (i, j, omp_get_thread_num ());
 
     zoom ();
   }
@@ -232,20 +534,17 @@ unsigned mandel_compute_omptiled (unsigned nb_iter)
 
 unsigned mandel_compute_omptask (unsigned nb_iter)
 {
-  tranche = DIM / GRAIN;
-  
+  overlay_begin (grain);
+
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
     // On itére sur les coordonnées des tuiles
     #pragma omp parallel
     #pragma omp master
-    for (int i=0; i < GRAIN; i++)
-      for (int j=0; j < GRAIN; j++)
-      #pragma omp task firstprivate(i, j, tranche)
-	traiter_tuile (i * tranche /* i debut */,
-		       j * tranche /* j debut */,
-		       (i + 1) * tranche - 1 /* i fin */,
-		       (j + 1) * tranche - 1 /* j fin */);
+    for (int i=0; i < grain; i++)
+      for (int j=0; j < grain; j++)
+      #pragma omp task firstprivate(i, j)
+	traiter_tuile_ij (i, j, omp_get_thread_num ());
 
     zoom ();
   }
@@ -253,8 +552,21 @@ unsigned mandel_compute_omptask (unsigned nb_iter)
   return 0;
 }
 
+// Tuiles de omptiled (paquets de omptiled_chunk) et de omptask (une à une)
+static void mandel_ft_omptiled (void)
+{
+  first_touch_tiles (grain, omptiled_chunk);
+}
+
+static void mandel_ft_omptask (void)
+{
+  first_touch_tiles (grain, 1);
+}
+
 ///////////////////////////// Version OpenMP avec omp for (omp)
 
+// À ajouter à mandel_versions une fois écrite : tant qu'elle ne calcule
+// rien, --check et --bench all la compareraient à seq pour rien
 
 unsigned mandel_compute_omp (unsigned nb_iter)
 {
@@ -265,22 +577,11 @@ unsigned mandel_compute_omp (unsigned nb_iter)
 
 ///////////////////////////// Version utilisant un ordonnanceur maison (sched)
 
-static unsigned proc_color [7] = {
-  0x00F9F9FF,           // Cyan
-  0xAE4AFFFF,           // Purple
-  0x66CCFFFF,           // Sky Blue
-  0xFF6666FF,           // Salmon
-  0xFFFF00FF,           // Yellow
-  0xFF7426FF,           // Orange
-  0x00FF00FF,           // Green
-};
-
 unsigned P;
 
 void mandel_init_sched ()
 {
-  xstep = (rightX - leftX) / DIM;
-  ystep = (topY - bottomY) / DIM;
+  mandel_init_tiled ();
 
   P = scheduler_init (-1);
 }
@@ -314,14 +615,6 @@ static inline void create_task (task_func_t t, int i, int j)
 
 //////// First Touch
 
-static void zero_seq (int i_d, int j_d, int i_f, int j_f)
-{
-
-  for (int i = i_d; i <= i_f; i++)
-    for (int j = j_d; j <= j_f; j++)
-      cur_img (i, j) = 0 ;
-}
-
 static void first_touch_task (void *p, unsigned proc)
 {
   int i, j;
@@ -329,15 +622,13 @@ static void first_touch_task (void *p, unsigned proc)
   unpack (p, &i, &j);
 
   //PRINT_DEBUG ('s', "First-touch Task is running on tile (%d, %d) over cpu #%d\n", i, j, proc);
-  zero_seq (i * tranche, j * tranche, (i + 1) * tranche - 1, (j + 1) * tranche - 1);
+  first_touch_region (tranche (i), tranche (j), tranche (i + 1) - 1, tranche (j + 1) - 1);
 }
 
 void mandel_ft_sched (void)
 {
-  tranche = DIM / GRAIN;
-
-  for (int i = 0; i < GRAIN; i++)
-    for (int j = 0; j < GRAIN; j++)
+  for (int i = 0; i < grain; i++)
+    for (int j = 0; j < grain; j++)
       create_task (first_touch_task, i, j);
 
   scheduler_task_wait ();
@@ -352,23 +643,17 @@ static void compute_task (void *p, unsigned proc)
   unpack (p, &i, &j);
   
   //PRINT_DEBUG ('s', "Compute Task is running on tile (%d, %d) over cpu #%d\n", i, j, proc);
-  traiter_tuile (i * tranche, j * tranche, (i + 1) * tranche - 1, (j + 1) * tranche - 1);
-#if 1
-  // For debugging purpose
-  for (int line = i * tranche; line <= i * tranche + 5; line++)
-    for (int col = j * tranche; col <= j * tranche + 5; col++)
-      cur_img (line, col) = proc_color [proc % 7];
-#endif
+  traiter_tuile_ij (i, j, proc);
 }
 
 unsigned mandel_compute_sched (unsigned nb_iter)
 {
-  tranche = DIM / GRAIN;
+  overlay_begin (grain);
 
   for (unsigned it = 1; it <= nb_iter; it ++) {
 
-    for (int i = 0; i < GRAIN; i++)
-      for (int j = 0; j < GRAIN; j++)
+    for (int i = 0; i < grain; i++)
+      for (int j = 0; j < grain; j++)
 	create_task (compute_task, i, j);
 
     scheduler_task_wait ();
@@ -379,6 +664,250 @@ unsigned mandel_compute_sched (unsigned nb_iter)
   return 0;
 }
 
+///////////////////////////// Version progressive (progressive)
+
+// Chaque image est calculée en passes de plus en plus fines : un point
+// sur PROG_COARSE dans chaque direction, puis un sur PROG_COARSE / 2, etc.
+// Une passe ne calcule que les points absents des passes précédentes
+// (chaque pixel est calculé une seule fois, comme dans seq) et peint avec
+// chacun d'eux le carré dont il est le coin, d'où une image complète mais
+// grossière à la fin de chaque passe. Les passes intermédiaires de la
+// dernière image d'un lot sont affichées au fil de l'eau.
+
+#define PROG_COARSE 8
+
+static void fill_block (int i, int j, int s, unsigned iter)
+{
+  int i_f = MIN (i + s, DIM), j_f = MIN (j + s, DIM);
+
+  sample_iter (i, j, iter);
+
+  if (index_image != NULL) {
+    Uint8 idx = iteration_to_index (iter);
+
+    for (int y = i; y < i_f; y++)
+      for (int x = j; x < j_f; x++)
+	cur_idx (y, x) = idx;
+  } else {
+    unsigned color = iteration_to_color (iter, max_iterations);
+
+    for (int y = i; y < i_f; y++)
+      for (int x = j; x < j_f; x++)
+	cur_img (y, x) = color;
+  }
+}
+
+static void progressive_pass (int s)
+{
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < DIM; i += s) {
+    // Sur les lignes de la passe précédente, un point sur deux est connu
+    int first = (s < PROG_COARSE && i % (2 * s) == 0) ? s : 0;
+    int step = first ? 2 * s : s;
+
+    if (view_cancelled ())
+      continue;
+
+    for (int j = first; j < DIM; j += step)
+      fill_block (i, j, s, compute_one_pixel (i, j));
+  }
+}
+
+unsigned mandel_compute_progressive (unsigned nb_iter)
+{
+  // Pas d'affichage depuis le thread de calcul de --interactive, qui
+  // réaffiche de lui-même pendant le calcul
+  int publish = graphics_display_enabled () && !do_interactive;
+
+  for (unsigned it = 1; it <= nb_iter; it ++) {
+
+    for (int s = PROG_COARSE; s >= 1; s /= 2) {
+      progressive_pass (s);
+
+      PRINT_DEBUG ('p', "progressive: pass 1/%d done\n", s);
+
+      // La passe complète est affichée par la boucle principale
+      if (publish && it == nb_iter && s > 1)
+	graphics_refresh ();
+    }
+
+    zoom ();
+  }
+
+  return 0;
+}
+
+// Lignes distribuées dynamiquement, une à une (progressive et aa) : au
+// plus près, paquets cycliques d'une ligne
+static void mandel_ft_progressive (void)
+{
+  first_touch_rows (1);
+}
+
+///////////////////////////// Version anticrénelée (aa)
+
+// Un premier passage calcule un point par pixel et garde son nombre
+// d'itérations. Les pixels dont la couleur s'écarte de plus de
+// aa_contrast de celle d'un voisin (haut, bas, gauche, droite) forment
+// une liste de travail, traitée en parallèle : chacun est rééchantillonné
+// sur une grille de aa_grid x aa_grid cases, avec un point tiré au hasard
+// dans chaque case (« jittered grid »), et prend la moyenne de leurs
+// couleurs. Les sous-échantillons sont calculés en double précision :
+// leur écart est sous la précision des float.
+// MANDEL_AA=<n> règle la taille de la grille, MANDEL_AA_CONTRAST le seuil
+// (somme des écarts sur les trois canaux) : changer simplement de bande
+// de la palette marquerait la moitié des pixels dans les zones détaillées.
+
+#define AA_GRID_MAX 8
+
+static unsigned aa_grid = 4;
+static unsigned aa_contrast = 64;
+static unsigned *aa_iter = NULL; // itérations du premier passage
+static size_t *aa_list = NULL;   // pixels à rééchantillonner (i * DIM + j)
+static size_t aa_count;
+
+void mandel_init_aa ()
+{
+  char *str = getenv ("MANDEL_AA");
+
+  mandel_init_seq ();
+
+  if (str != NULL) {
+    aa_grid = atoi (str);
+    if (aa_grid < 2 || aa_grid > AA_GRID_MAX)
+      exit_with_error ("MANDEL_AA must be in [2, %d]\n", AA_GRID_MAX);
+  }
+
+  str = getenv ("MANDEL_AA_CONTRAST");
+  if (str != NULL)
+    aa_contrast = atoi (str);
+}
+
+void mandel_finalize_aa ()
+{
+  free (aa_iter);
+  free (aa_list);
+  // --bench rappelle init puis compute : réallouer au prochain appel
+  aa_iter = NULL;
+  aa_list = NULL;
+}
+
+// Nombre dans [0, 1[ ne dépendant que du sous-échantillon (finaliseur de
+// splitmix64) : l'image ne dépend pas de l'ordre de calcul
+static inline double aa_jitter (unsigned i, unsigned j, unsigned s)
+{
+  uint64_t h = ((uint64_t) i << 40) ^ ((uint64_t) j << 16) ^ s;
+
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  return (h >> 11) * 0x1.0p-53;
+}
+
+static unsigned aa_pixel (int i, int j)
+{
+  double xs = ((double) rightX - leftX) / DIM;
+  double ys = ((double) topY - bottomY) / DIM;
+  unsigned n = aa_grid, r = 0, g = 0, b = 0;
+
+  for (unsigned sy = 0; sy < n; sy++)
+    for (unsigned sx = 0; sx < n; sx++) {
+      unsigned s = 2 * (sy * n + sx);
+      double x = j + (sx + aa_jitter (i, j, s)) / n;
+      double y = i + (sy + aa_jitter (i, j, s + 1)) / n;
+      unsigned c = iteration_to_color (compute_one_point (leftX + xs * x, topY - ys * y),
+				       max_iterations);
+
+      r += c >> 24;
+      g += (c >> 16) & 255;
+      b += (c >> 8) & 255;
+    }
+
+  n *= n;
+  return ((r + n / 2) / n) << 24 | ((g + n / 2) / n) << 16 | ((b + n / 2) / n) << 8 | 255;
+}
+
+// Écart entre les couleurs de deux pixels (somme des écarts par canal)
+static inline unsigned aa_distance (unsigned a, unsigned b)
+{
+  unsigned d = 0;
+
+  for (int shift = 8; shift < 32; shift += 8)
+    d += abs ((int) ((a >> shift) & 255) - (int) ((b >> shift) & 255));
+
+  return d;
+}
+
+static inline int aa_edge (int i, int j)
+{
+  unsigned c = iteration_to_color (aa_iter [(size_t) i * DIM + j], max_iterations);
+
+  return (i > 0 && aa_distance (c, cur_img (i - 1, j)) > aa_contrast)
+    || (i < DIM - 1 && aa_distance (c, cur_img (i + 1, j)) > aa_contrast)
+    || (j > 0 && aa_distance (c, cur_img (i, j - 1)) > aa_contrast)
+    || (j < DIM - 1 && aa_distance (c, cur_img (i, j + 1)) > aa_contrast);
+}
+
+unsigned mandel_compute_aa (unsigned nb_iter)
+{
+  // DIM n'est connu qu'après graphics_init
+  if (aa_iter == NULL) {
+    aa_iter = malloc ((size_t) DIM * DIM * sizeof (unsigned));
+    aa_list = malloc ((size_t) DIM * DIM * sizeof (size_t));
+  }
+
+  for (unsigned it = 1; it <= nb_iter; it ++) {
+
+    aa_count = 0;
+
+    #pragma omp parallel
+    {
+      size_t *row = malloc (DIM * sizeof (size_t));
+
+      #pragma omp for schedule(dynamic)
+      for (int i = 0; i < DIM; i++)
+	for (int j = 0; j < DIM; j++) {
+	  unsigned iter = compute_one_pixel (i, j);
+
+	  sample_iter (i, j, iter);
+	  aa_iter [(size_t) i * DIM + j] = iter;
+	  cur_img (i, j) = iteration_to_color (iter, max_iterations);
+	}
+
+      // Une réservation dans la liste par ligne
+      #pragma omp for schedule(static)
+      for (int i = 0; i < DIM; i++) {
+	unsigned n = 0;
+
+	for (int j = 0; j < DIM; j++)
+	  if (aa_edge (i, j))
+	    row [n++] = (size_t) i * DIM + j;
+
+	if (n > 0)
+	  memcpy (aa_list + __atomic_fetch_add (&aa_count, n, __ATOMIC_RELAXED),
+		  row, n * sizeof (size_t));
+      }
+
+      #pragma omp for schedule(dynamic,16)
+      for (size_t k = 0; k < aa_count; k++)
+	cur_img (aa_list [k] / DIM, aa_list [k] % DIM) =
+	  aa_pixel (aa_list [k] / DIM, aa_list [k] % DIM);
+
+      free (row);
+    }
+
+    PRINT_DEBUG ('p', "aa: %zu edge pixels (%.1f%%), %u samples each\n",
+		 aa_count, 100.0 * aa_count / ((double) DIM * DIM), aa_grid * aa_grid);
+
+    zoom ();
+  }
+
+  return 0;
+}
+
 //////////////////////////////////////////////////////////////////////////
 ///////////////////////////// Version OpenCL
 
@@ -386,6 +915,12 @@ void mandel_init_ocl ()
 {
   xstep = (rightX - leftX) / DIM;
   ystep = (topY - bottomY) / DIM;
+
+  mandel_iter_init ();
+
+  // Chaque lot écrit dans next_buffer puis échange les tampons : sans
+  // affichage, le lot suivant peut tourner pendant la relecture du précédent
+  ocl_pingpong = 1;
 }
 
 unsigned mandel_compute_ocl (unsigned nb_iter)
@@ -393,28 +928,327 @@ unsigned mandel_compute_ocl (unsigned nb_iter)
   size_t global[2] = { SIZE, SIZE };  // global domain size for our calculation
   size_t local[2]  = { TILEX, TILEY };  // local domain size for our calculation
   cl_int err;
-  unsigned max_iter = MAX_ITERATIONS;
   
   for (unsigned it = 1; it <= nb_iter; it ++) {
     
     // Set kernel arguments
     //
     err = 0;
-    err |= clSetKernelArg (compute_kernel, 0, sizeof (cl_mem), &cur_buffer);
+    err |= clSetKernelArg (compute_kernel, 0, sizeof (cl_mem), &next_buffer);
     err |= clSetKernelArg (compute_kernel, 1, sizeof (float), &leftX);
     err |= clSetKernelArg (compute_kernel, 2, sizeof (float), &xstep);
     err |= clSetKernelArg (compute_kernel, 3, sizeof (float), &topY);
     err |= clSetKernelArg (compute_kernel, 4, sizeof (float), &ystep);
-    err |= clSetKernelArg (compute_kernel, 5, sizeof (unsigned), &max_iter);
+    err |= clSetKernelArg (compute_kernel, 5, sizeof (unsigned), &max_iterations);
 
     check (err, "Failed to set kernel arguments");
 
     err = clEnqueueNDRangeKernel (queue, compute_kernel, 2, NULL, global, local,
-				  0, NULL, NULL);
+				  0, NULL, ocl_event ("mandel"));
     check (err, "Failed to execute kernel");
 
     zoom ();
   }
 
+  // Une seule alternance par lot, quel que soit nb_iter
+  { cl_mem tmp = cur_buffer; cur_buffer = next_buffer; next_buffer = tmp; }
+
   return 0;
 }
+
+///////////////////////////// Version OpenCL par lots (oclbatch)
+
+// Les cadres des nb_iter images sont précalculés sur l'hôte puis envoyés
+// en une écriture ; un seul NDRange 3D (x, y, image) calcule tout le lot.
+
+static cl_kernel batch_kernel = NULL;
+static cl_mem view_buffer = NULL;
+static cl_mem scratch_buffer = NULL; // images intermédiaires du lot
+static cl_event view_written = NULL;
+static cl_float4 *views = NULL;
+static unsigned view_capacity = 0;
+
+void mandel_init_oclbatch ()
+{
+  mandel_init_ocl ();
+}
+
+void mandel_finalize_oclbatch ()
+{
+  if (view_written != NULL)
+    clReleaseEvent (view_written);
+  if (view_buffer != NULL)
+    clReleaseMemObject (view_buffer);
+  if (scratch_buffer != NULL)
+    clReleaseMemObject (scratch_buffer);
+  if (batch_kernel != NULL)
+    clReleaseKernel (batch_kernel);
+  free (views);
+
+  // --bench peut relancer la version : tout sera recréé au prochain appel
+  view_written = NULL;
+  view_buffer = NULL;
+  scratch_buffer = NULL;
+  batch_kernel = NULL;
+  views = NULL;
+  view_capacity = 0;
+}
+
+unsigned mandel_compute_oclbatch (unsigned nb_iter)
+{
+  size_t global[3] = { SIZE, SIZE, nb_iter };
+  size_t local[3]  = { TILEX, TILEY, 1 };
+  // Une seule limite pour tout le lot : celle de sa première image
+  unsigned max_iter = max_iterations;
+  cl_int err;
+
+  if (batch_kernel == NULL) {
+    batch_kernel = ocl_create_kernel ("mandel_batch");
+    scratch_buffer = clCreateBuffer (context, CL_MEM_WRITE_ONLY,
+				     sizeof (unsigned) * DIM * DIM, NULL, &err);
+    check (err, "Failed to allocate scratch buffer");
+  }
+
+  // Le tableau hôte ne peut être réécrit qu'une fois l'envoi précédent fait
+  if (view_written != NULL) {
+    clWaitForEvents (1, &view_written);
+    clReleaseEvent (view_written);
+    view_written = NULL;
+  }
+
+  if (nb_iter > view_capacity) {
+    if (view_buffer != NULL)
+      clReleaseMemObject (view_buffer);
+
+    view_capacity = nb_iter;
+    views = realloc (views, view_capacity * sizeof (cl_float4));
+    view_buffer = clCreateBuffer (context, CL_MEM_READ_ONLY,
+				  view_capacity * sizeof (cl_float4), NULL, &err);
+    check (err, "Failed to allocate view buffer");
+  }
+
+  for (unsigned it = 0; it < nb_iter; it ++) {
+    views [it].s[0] = leftX;
+    views [it].s[1] = xstep;
+    views [it].s[2] = topY;
+    views [it].s[3] = ystep;
+    zoom ();
+  }
+
+  err = clEnqueueWriteBuffer (queue, view_buffer, CL_FALSE, 0,
+			      nb_iter * sizeof (cl_float4), views,
+			      0, NULL, &view_written);
+  check (err, "Failed to write view buffer");
+
+  err = 0;
+  err |= clSetKernelArg (batch_kernel, 0, sizeof (cl_mem), &next_buffer);
+  err |= clSetKernelArg (batch_kernel, 1, sizeof (cl_mem), &scratch_buffer);
+  err |= clSetKernelArg (batch_kernel, 2, sizeof (cl_mem), &view_buffer);
+  err |= clSetKernelArg (batch_kernel, 3, sizeof (unsigned), &max_iter);
+  check (err, "Failed to set kernel arguments");
+
+  err = clEnqueueNDRangeKernel (queue, batch_kernel, 3, NULL, global, local,
+				0, NULL, ocl_event ("mandel_batch"));
+  check (err, "Failed to execute kernel");
+
+  { cl_mem tmp = cur_buffer; cur_buffer = next_buffer; next_buffer = tmp; }
+
+  PRINT_DEBUG ('o', "oclbatch: %u frames in one launch\n", nb_iter);
+
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////// Version hybride CPU + OpenCL (hybrid)
+
+// Les lignes [0, cpu_rows[ sont calculées par les cœurs (OpenMP), les
+// lignes [cpu_rows, DIM[ par le périphérique OpenCL (GPU, ou CPU avec
+// DEVICE_TYPE=cpu, par exemple avec PoCL), puis relues dans image. La
+// proportion confiée au périphérique suit, d'une image à l'autre, les
+// débits mesurés des deux côtés.
+
+static float gpu_share = 0.5;
+
+void mandel_init_hybrid ()
+{
+  // Pas de palette : les lignes OpenCL arrivent déjà en couleurs
+  xstep = (rightX - leftX) / DIM;
+  ystep = (topY - bottomY) / DIM;
+
+  mandel_iter_init ();
+}
+
+static cl_ulong event_time (cl_event evt, cl_profiling_info what)
+{
+  cl_ulong t = 0;
+
+  clGetEventProfilingInfo (evt, what, sizeof (t), &t, NULL);
+  return t;
+}
+
+unsigned mandel_compute_hybrid (unsigned nb_iter)
+{
+  cl_int err;
+
+  // ocl_init a besoin de DIM, connu seulement après graphics_init ; il
+  // ne fait rien si OpenCL est déjà initialisé
+  ocl_init ();
+
+  for (unsigned it = 1; it <= nb_iter; it ++) {
+    unsigned gpu_rows = (unsigned) (gpu_share * DIM) / TILEY * TILEY;
+    unsigned cpu_rows;
+    cl_event kernel_evt = NULL, read_evt = NULL;
+    double t_cpu, t_dev = 0.0;
+
+    // Chaque côté garde au moins une rangée de tuiles, pour mesurer son débit
+    gpu_rows = MAX (TILEY, MIN (gpu_rows, DIM - TILEY));
+    cpu_rows = DIM - gpu_rows;
+
+    {
+      size_t offset[2] = { 0, cpu_rows };
+      size_t global[2] = { DIM, gpu_rows };
+      size_t local[2]  = { TILEX, TILEY };
+
+      err = 0;
+      err |= clSetKernelArg (compute_kernel, 0, sizeof (cl_mem), &cur_buffer);
+      err |= clSetKernelArg (compute_kernel, 1, sizeof (float), &leftX);
+      err |= clSetKernelArg (compute_kernel, 2, sizeof (float), &xstep);
+      err |= clSetKernelArg (compute_kernel, 3, sizeof (float), &topY);
+      err |= clSetKernelArg (compute_kernel, 4, sizeof (float), &ystep);
+      err |= clSetKernelArg (compute_kernel, 5, sizeof (unsigned), &max_iterations);
+      check (err, "Failed to set kernel arguments");
+
+      err = clEnqueueNDRangeKernel (queue, compute_kernel, 2, offset, global, local,
+				    0, NULL, &kernel_evt);
+      check (err, "Failed to execute kernel");
+
+      err = clEnqueueReadBuffer (queue, cur_buffer, CL_FALSE,
+				 (size_t) cpu_rows * DIM * sizeof (unsigned),
+				 (size_t) gpu_rows * DIM * sizeof (unsigned),
+				 img_cell (image, cpu_rows, 0), 0, NULL, &read_evt);
+      check (err, "Failed to read back device rows");
+
+      clFlush (queue);
+    }
+
+    t_cpu = omp_get_wtime ();
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < cpu_rows; i++)
+      for (int j = 0; j < DIM; j++)
+	store_pixel (i, j, compute_one_pixel (i, j));
+
+    t_cpu = omp_get_wtime () - t_cpu;
+
+    err = clWaitForEvents (1, &read_evt);
+    check (err, "Failed to wait for device rows");
+
+    t_dev = (event_time (read_evt, CL_PROFILING_COMMAND_END)
+	     - event_time (kernel_evt, CL_PROFILING_COMMAND_START)) * 1e-9;
+
+    clReleaseEvent (kernel_evt);
+    clReleaseEvent (read_evt);
+
+    // Nouvelle répartition : proportionnelle aux débits (lignes/s), lissée
+    if (t_cpu > 0.0 && t_dev > 0.0) {
+      double r_cpu = cpu_rows / t_cpu, r_dev = gpu_rows / t_dev;
+
+      gpu_share = 0.5 * gpu_share + 0.5 * r_dev / (r_dev + r_cpu);
+    }
+
+    PRINT_DEBUG ('o', "hybrid: %u rows on device (%.3f ms), %u rows on CPU (%.3f ms), next share %.2f\n",
+		 gpu_rows, t_dev * 1e3, cpu_rows, t_cpu * 1e3, gpu_share);
+
+    zoom ();
+  }
+
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////// Réglage automatique (--autotune)
+
+static tuning_param_t mandel_params [] = {
+  { "grain", &grain, "tiled,omptiled,omptask,sched", 4, 256, TUNE_DIVIDES_DIM, NULL },
+  { "chunk", &omptiled_chunk, "omptiled", 1, 64, 0, NULL },
+  { "chunk", &omps_chunk, "omps", 1, 64, 0, NULL },
+  { "chunk", &ompd_chunk, "ompd", 1, 64, 0, NULL },
+  { NULL }
+};
+
+// Chaque mesure repart du cadre initial : sans cela, le zoom rendrait
+// les images de plus en plus coûteuses d'une mesure à l'autre
+static void mandel_rewind (void)
+{
+  static float frame [4];
+  static int saved = 0;
+
+  if (!saved) {
+    frame [0] = leftX; frame [1] = rightX; frame [2] = topY; frame [3] = bottomY;
+    saved = 1;
+  } else {
+    leftX = frame [0]; rightX = frame [1]; topY = frame [2]; bottomY = frame [3];
+  }
+
+  max_iterations = iter_start;
+
+  xstep = (rightX - leftX) / DIM;
+  ystep = (topY - bottomY) / DIM;
+}
+
+tuning_kernel_t mandel_tuning = { mandel_params, mandel_rewind };
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////// Navigation interactive (--interactive)
+
+// Appelé par le thread de calcul entre deux images
+static void mandel_navigate (double u, double v, double k)
+{
+  float w = rightX - leftX, h = topY - bottomY;
+
+  leftX += u * w;
+  rightX = leftX + k * w;
+  topY -= v * h;
+  bottomY = topY - k * h;
+
+  xstep = (rightX - leftX) / DIM;
+  ystep = (topY - bottomY) / DIM;
+
+  frozen = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////// Registre des versions
+
+// Aucune version n'utilise alt_image ; hybrid initialise elle-même OpenCL
+// et relit ses lignes dans image, comme une version CPU
+static version_desc_t mandel_versions [] = {
+  { "seq",      mandel_compute_seq,      mandel_init_seq,      NULL, NULL,
+    VERSION_INDEXED | VERSION_SEQUENTIAL },
+  { "omps",     mandel_compute_omps,     mandel_init_omps,     NULL,
+    mandel_ft_omps, VERSION_INDEXED },
+  { "ompd",     mandel_compute_ompd,     mandel_init_ompd,     NULL,
+    mandel_ft_ompd, VERSION_INDEXED },
+  { "tiled",    mandel_compute_tiled,    mandel_init_tiled,    NULL, NULL,
+    VERSION_INDEXED | VERSION_SEQUENTIAL },
+  { "omptiled", mandel_compute_omptiled, mandel_init_omptiled, NULL,
+    mandel_ft_omptiled, VERSION_INDEXED },
+  { "omptask",  mandel_compute_omptask,  mandel_init_omptask,  NULL,
+    mandel_ft_omptask, VERSION_INDEXED },
+  { "sched",    mandel_compute_sched,    mandel_init_sched,    mandel_finalize_sched,
+    mandel_ft_sched, VERSION_INDEXED },
+  { "progressive", mandel_compute_progressive, mandel_init_seq, NULL,
+    mandel_ft_progressive, VERSION_INDEXED },
+  { "aa",       mandel_compute_aa,       mandel_init_aa,       mandel_finalize_aa,
+    mandel_ft_progressive, VERSION_NO_CHECK },
+  { "ocl",      mandel_compute_ocl,      mandel_init_ocl,      NULL, NULL, VERSION_OPENCL },
+  { "oclbatch", mandel_compute_oclbatch, mandel_init_oclbatch, mandel_finalize_oclbatch,
+    NULL, VERSION_OPENCL },
+  { "hybrid",   mandel_compute_hybrid,   mandel_init_hybrid,   NULL, NULL, 0 },
+  { NULL }
+};
+
+static kernel_desc_t mandel_kernel = { "mandel", mandel_versions, mandel_tile, &mandel_tuning,
+				       mandel_navigate };
+
+REGISTER_KERNEL (mandel_kernel)
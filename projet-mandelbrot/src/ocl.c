@@ -1,28 +1,37 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 
 
 #include "constants.h"
 #include "error.h"
 #include "ocl.h"
 #include "graphics.h"
+#include "compute.h"
 #include "debug.h"
+#include "hash.h"
+#include "histogram.h"
 
 #define MAX_PLATFORMS 3
 #define MAX_DEVICES   5
 
 unsigned TILEX = 16;
-unsigned TILEY = 16;
+unsigned TILEY = 0; // 0 : comme TILEX
 unsigned SIZE = 0;
 
 static char *kernel_name = DEFAULT_KERNEL;
 
 cl_int err;
 cl_context context;
+static cl_device_id device;
+static cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+static cl_program program;
+static char device_id_str [5 * 1024 + 4]; // 5 chaînes de 1024 octets et leurs séparateurs
 cl_kernel update_kernel;
 cl_kernel compute_kernel;
 cl_command_queue queue;
@@ -66,11 +75,153 @@ static char *file_load (const char *filename)
   return b;
 }
 
+// Profilage des commandes OpenCL (-op <fichier>) : chaque commande mise en
+// file reçoit un événement (ocl_event), dont on relève plus tard les dates
+// de mise en file, de soumission, de début et de fin d'exécution. Les
+// trois délais (attente avant soumission, avant exécution, exécution)
+// sont rangés par noyau dans des histogrammes (histogram.h).
+
+#define PROF_PENDING 256
+#define PROF_LABELS  16
+
+char *ocl_profile_file = NULL;
+
+struct prof_stat {
+  const char *label;
+  histogram_t queued;    // mise en file -> soumission, en ns
+  histogram_t submitted; // soumission -> début
+  histogram_t exec;      // début -> fin
+};
+
+static const char *prof_phase [] = { "queued", "submit", "exec" };
+
+static struct prof_stat prof [PROF_LABELS];
+static unsigned nb_labels = 0;
+
+static struct {
+  cl_event evt;
+  const char *label;
+} pending [PROF_PENDING];
+static unsigned nb_pending = 0;
+
+static struct prof_stat *prof_find (const char *label)
+{
+  for (unsigned i = 0; i < nb_labels; i++)
+    if (!strcmp (prof [i].label, label))
+      return &prof [i];
+
+  if (nb_labels == PROF_LABELS)
+    exit_with_error ("Too many profiled OpenCL commands\n");
+
+  prof [nb_labels].label = label;
+  histogram_reset (&prof [nb_labels].queued);
+  histogram_reset (&prof [nb_labels].submitted);
+  histogram_reset (&prof [nb_labels].exec);
+
+  return &prof [nb_labels++];
+}
+
+static void ocl_profiling_flush (void)
+{
+  for (unsigned i = 0; i < nb_pending; i++) {
+    struct prof_stat *st = prof_find (pending [i].label);
+    cl_ulong t [4];
+
+    err = clWaitForEvents (1, &pending [i].evt);
+    check (err, "Failed to wait for event");
+
+    err  = clGetEventProfilingInfo (pending [i].evt, CL_PROFILING_COMMAND_QUEUED,
+				    sizeof (cl_ulong), &t [0], NULL);
+    err |= clGetEventProfilingInfo (pending [i].evt, CL_PROFILING_COMMAND_SUBMIT,
+				    sizeof (cl_ulong), &t [1], NULL);
+    err |= clGetEventProfilingInfo (pending [i].evt, CL_PROFILING_COMMAND_START,
+				    sizeof (cl_ulong), &t [2], NULL);
+    err |= clGetEventProfilingInfo (pending [i].evt, CL_PROFILING_COMMAND_END,
+				    sizeof (cl_ulong), &t [3], NULL);
+    check (err, "Failed to get profiling info");
+
+    clReleaseEvent (pending [i].evt);
+
+    histogram_record (&st->queued, t [1] - t [0]);
+    histogram_record (&st->submitted, t [2] - t [1]);
+    histogram_record (&st->exec, t [3] - t [2]);
+  }
+
+  nb_pending = 0;
+}
+
+// Renvoie l'emplacement où ranger l'événement de la prochaine commande,
+// ou NULL si le profilage n'est pas demandé
+cl_event *ocl_event (const char *label)
+{
+  if (ocl_profile_file == NULL)
+    return NULL;
+
+  if (nb_pending == PROF_PENDING)
+    ocl_profiling_flush ();
+
+  pending [nb_pending].label = label;
+
+  return &pending [nb_pending++].evt;
+}
+
+void ocl_profiling_report (void)
+{
+  FILE *f;
+
+  if (ocl_profile_file == NULL)
+    return;
+
+  ocl_profiling_flush ();
+
+  if (!strcmp (ocl_profile_file, "-")) {
+    fprintf (stderr, "--- OpenCL profiling ---\n");
+    for (unsigned i = 0; i < nb_labels; i++) {
+      struct prof_stat *st = &prof [i];
+
+      fprintf (stderr, "%-16s %6lu launches  exec total %.3f ms\n",
+	       st->label, (unsigned long) st->exec.count, st->exec.sum / 1e6);
+      histogram_print (&st->queued, prof_phase [0], stderr);
+      histogram_print (&st->submitted, prof_phase [1], stderr);
+      histogram_print (&st->exec, prof_phase [2], stderr);
+    }
+    fprintf (stderr, "------------------------\n");
+    return;
+  }
+
+  f = fopen (ocl_profile_file, "w");
+  if (f == NULL)
+    exit_with_error ("Cannot open %s\n", ocl_profile_file);
+
+  fprintf (f, "kernel,count,exec_total_ms");
+  for (unsigned p = 0; p < 3; p++)
+    fprintf (f, ",%s_mean_us,%s_min_us,%s_p50_us,%s_p90_us,%s_p99_us,%s_max_us",
+	     prof_phase [p], prof_phase [p], prof_phase [p],
+	     prof_phase [p], prof_phase [p], prof_phase [p]);
+  fprintf (f, "\n");
+
+  for (unsigned i = 0; i < nb_labels; i++) {
+    struct prof_stat *st = &prof [i];
+    histogram_t *h [3] = { &st->queued, &st->submitted, &st->exec };
+
+    fprintf (f, "%s,%lu,%.3f", st->label, (unsigned long) st->exec.count, st->exec.sum / 1e6);
+    for (unsigned p = 0; p < 3; p++)
+      fprintf (f, ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f",
+	       h [p]->sum / 1e3 / h [p]->count, h [p]->min / 1e3,
+	       histogram_percentile (h [p], 50) / 1e3, histogram_percentile (h [p], 90) / 1e3,
+	       histogram_percentile (h [p], 99) / 1e3, h [p]->max / 1e3);
+    fprintf (f, "\n");
+  }
+
+  fclose (f);
+  printf ("OpenCL profile written to %s\n", ocl_profile_file);
+}
+
 static void ocl_acquire (void)
 {
   cl_int err;
 
-  err = clEnqueueAcquireGLObjects (queue, 1, &tex_buffer, 0, NULL, NULL);
+  err = clEnqueueAcquireGLObjects (queue, 1, &tex_buffer, 0, NULL, ocl_event ("acquire_gl"));
   check (err, "Failed to acquire lock");
 }
 
@@ -78,22 +229,223 @@ static void ocl_release (void)
 {
   cl_int err;
 
-  err = clEnqueueReleaseGLObjects (queue, 1, &tex_buffer, 0, NULL, NULL);
+  err = clEnqueueReleaseGLObjects (queue, 1, &tex_buffer, 0, NULL, ocl_event ("release_gl"));
   check (err, "Failed to release lock");
 }
 
+// Cache des programmes compilés : le binaire est rangé dans
+// OCL_CACHE_DIR (kernel/.cache par défaut) sous un nom dérivé du source,
+// des options de compilation et de l'identité du périphérique/pilote.
+// Toute modification de l'un d'eux change le nom, donc invalide le cache.
+// OCL_NO_CACHE désactive le cache.
+static char *ocl_cache_path (const char *src, const char *flags)
+{
+  static char path [1024];
+  char *dir = getenv ("OCL_CACHE_DIR");
+  uint64_t h;
+
+  if (getenv ("OCL_NO_CACHE") != NULL)
+    return NULL;
+
+  if (dir == NULL)
+    dir = "kernel/.cache";
+
+  if (mkdir (dir, 0755) < 0 && errno != EEXIST) {
+    PRINT_DEBUG ('o', "Cannot create OpenCL cache directory %s\n", dir);
+    return NULL;
+  }
+
+  h = hash_string (HASH_INIT, src);
+  h = hash_string (h, flags);
+  h = hash_string (h, device_id_str);
+
+  snprintf (path, sizeof (path), "%s/%016llx.bin", dir, (unsigned long long) h);
+
+  return path;
+}
+
+static cl_program ocl_load_binary (const char *path, const char *flags)
+{
+  const unsigned char *bin;
+  cl_program prg;
+  cl_int status;
+  size_t size;
+  struct stat sb;
+
+  if (path == NULL || stat (path, &sb) < 0)
+    return NULL;
+
+  size = sb.st_size;
+  bin = (unsigned char *) file_load (path);
+
+  prg = clCreateProgramWithBinary (context, 1, &device, &size, &bin, &status, &err);
+  free ((void *) bin);
+
+  if (err != CL_SUCCESS || status != CL_SUCCESS)
+    return NULL;
+
+  // Obligatoire même pour un binaire, mais quasi instantané
+  if (clBuildProgram (prg, 0, NULL, flags, NULL, NULL) != CL_SUCCESS) {
+    clReleaseProgram (prg);
+    return NULL;
+  }
+
+  printf ("Using cached OpenCL binary %s\n", path);
+
+  return prg;
+}
+
+static void ocl_save_binary (const char *path)
+{
+  unsigned char *bin;
+  char tmp [1100];
+  size_t size;
+  FILE *f;
+
+  if (path == NULL)
+    return;
+
+  err = clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, sizeof (size), &size, NULL);
+  if (err != CL_SUCCESS || size == 0)
+    return;
+
+  bin = malloc (size);
+  err = clGetProgramInfo (program, CL_PROGRAM_BINARIES, sizeof (bin), &bin, NULL);
+
+  // Écriture dans un fichier temporaire puis renommage atomique : deux
+  // lancements simultanés ne peuvent pas laisser un binaire tronqué
+  snprintf (tmp, sizeof (tmp), "%s.%d", path, getpid ());
+  f = fopen (tmp, "w");
+  if (err == CL_SUCCESS && f != NULL && fwrite (bin, size, 1, f) == 1) {
+    fclose (f);
+    if (rename (tmp, path) == 0)
+      PRINT_DEBUG ('o', "OpenCL binary saved to %s\n", path);
+  } else {
+    if (f != NULL)
+      fclose (f);
+    unlink (tmp);
+  }
+
+  free (bin);
+}
+
+static void ocl_build_program (void)
+{
+  char flags [1024];
+  char *cache;
+
+  // Load program source into memory
+  //
+  const char	*opencl_prog;
+  opencl_prog = file_load ("kernel/compute.cl");
+
+  sprintf (flags,
+	   "-cl-mad-enable -cl-fast-relaxed-math -DDIM=%d -DSIZE=%d -DTILEX=%d -DTILEY=%d",
+	   DIM, SIZE, TILEX, TILEY);
+
+  cache = ocl_cache_path (opencl_prog, flags);
+
+  program = ocl_load_binary (cache, flags);
+
+  if (program == NULL) {
+    // Attach program source to context
+    //
+    program = clCreateProgramWithSource (context, 1, &opencl_prog, NULL, &err);
+    check (err, "Failed to create program");
+
+    // Compile program
+    //
+    err = clBuildProgram (program, 0, NULL, flags, NULL, NULL);
+    // Display compiler log
+    //
+    {
+      size_t len;
+
+      clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+
+      if (len > 1) {
+	char buffer[len];
+
+	fprintf (stderr, "--- OpenCL Compiler log ---\n");
+	clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG,
+			       sizeof (buffer), buffer, NULL);
+	fprintf (stderr, "%s\n", buffer);
+	fprintf (stderr, "---------------------------\n");
+      }
+    }
+    
+    if(err != CL_SUCCESS)
+      exit_with_error ("Failed to build program!\n");
+
+    ocl_save_binary (cache);
+  }
+
+  free ((void *) opencl_prog);
+
+  // Create the compute kernel in the program we wish to run
+  //
+  compute_kernel = clCreateKernel (program, kernel_name, &err);
+  check (err, "Failed to create compute kernel");
+
+  printf ("Using kernel: %s\n", kernel_name);
+  
+  update_kernel = clCreateKernel (program, "update_texture", &err);
+  check (err, "Failed to create compute kernel");
+}
+
+// Recompilation avec d'autres TILEX/TILEY (réglage automatique)
+void ocl_rebuild_program (void)
+{
+  clFinish (queue);
+
+  clReleaseKernel (compute_kernel);
+  clReleaseKernel (update_kernel);
+  clReleaseProgram (program);
+
+  ocl_build_program ();
+}
+
+size_t ocl_max_workgroup_size (void)
+{
+  size_t max = 0;
+
+  err = clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof (max), &max, NULL);
+  check (err, "Failed to get max work-group size");
+
+  return max;
+}
+
+// Noyau supplémentaire du programme courant (ex : variante d'une version)
+cl_kernel ocl_create_kernel (const char *name)
+{
+  cl_kernel k = clCreateKernel (program, name, &err);
+
+  if (err != CL_SUCCESS)
+    exit_with_error ("(%d) Failed to create kernel %s\n", err, name);
+
+  return k;
+}
+
+unsigned ocl_initialized = 0;
+
+// Un seul contexte par exécution, quel que soit le nombre d'appels
+// (main, --bench, version hybrid...)
 void ocl_init (void)
 {
   char name [1024], vendor [1024];
   cl_platform_id pf [MAX_PLATFORMS];
   cl_uint nb_platforms = 0;
   cl_device_id devices [MAX_DEVICES];
-  cl_program program;                 // compute program
   cl_device_type dtype;
   cl_uint nb_devices = 0;
   char *str = NULL;
   unsigned platform_no = 0;
   unsigned dev = 0;
+  cl_mem_flags buffer_flags = CL_MEM_READ_WRITE;
+
+  if (ocl_initialized)
+    return;
+  ocl_initialized = 1;
 
   str = getenv ("PLATFORM");
   if (str != NULL)
@@ -109,22 +461,34 @@ void ocl_init (void)
   else
     SIZE = DIM;
 
+  // Les variables d'environnement l'emportent sur le profil de réglage
   str = getenv ("TILEX");
   if (str != NULL)
     TILEX = atoi (str);
-  else
-    TILEX = 16;
 
   str = getenv ("TILEY");
   if (str != NULL)
     TILEY = atoi (str);
-  else
+  else if (TILEY == 0)
     TILEY = TILEX;
 
   str = getenv ("KERNEL");
   if (str != NULL)
     kernel_name = str;
 
+  // DEVICE_TYPE=cpu|gpu|all (GPU par défaut)
+  str = getenv ("DEVICE_TYPE");
+  if (str != NULL) {
+    if (!strcmp (str, "cpu"))
+      device_type = CL_DEVICE_TYPE_CPU;
+    else if (!strcmp (str, "gpu"))
+      device_type = CL_DEVICE_TYPE_GPU;
+    else if (!strcmp (str, "all"))
+      device_type = CL_DEVICE_TYPE_ALL;
+    else
+      exit_with_error ("DEVICE_TYPE must be cpu, gpu or all (not %s)\n", str);
+  }
+
   if (SIZE > DIM)
     exit_with_error ("SIZE (%d) cannot exceed DIM (%d)", SIZE, DIM);
 
@@ -148,26 +512,42 @@ void ocl_init (void)
 
   // Get list of devices
   //
-  err = clGetDeviceIDs (pf [platform_no], CL_DEVICE_TYPE_GPU,
+  err = clGetDeviceIDs (pf [platform_no], device_type,
 			MAX_DEVICES, devices, &nb_devices);
   PRINT_DEBUG ('o', "nb devices = %d\n", nb_devices);
 
   if (nb_devices == 0) {
-    exit_with_error ("No GPU found on platform %d (%s - %s). Try PLATFORM=<p> ./prog blabla\n",
+    exit_with_error ("No %s found on platform %d (%s - %s). Try PLATFORM=<p> or DEVICE_TYPE=<cpu|gpu|all> ./prog blabla\n",
+		     (device_type == CL_DEVICE_TYPE_GPU) ? "GPU" : "device",
 		     platform_no, name, vendor);
   }
   if (dev >= nb_devices)
     exit_with_error ("Device number #%d too high\n", dev);
 
+  device = devices [dev];
+
   err = clGetDeviceInfo (devices [dev], CL_DEVICE_NAME, 1024, name, NULL);
   check (err, "Cannot get type of device");
+
+  // Identité plate-forme/périphérique/pilote, pour le cache de binaires
+  {
+    char dev_version [1024], drv_version [1024], pf_version [1024];
+
+    clGetPlatformInfo (pf [platform_no], CL_PLATFORM_VERSION, 1024, pf_version, NULL);
+    clGetDeviceInfo (device, CL_DEVICE_VERSION, 1024, dev_version, NULL);
+    clGetDeviceInfo (device, CL_DRIVER_VERSION, 1024, drv_version, NULL);
+    snprintf (device_id_str, sizeof (device_id_str), "%s|%s|%s|%s|%s",
+	      vendor, pf_version, name, dev_version, drv_version);
+  }
     
   err = clGetDeviceInfo (devices [dev], CL_DEVICE_TYPE, sizeof (cl_device_type), &dtype, NULL);
   check (err, "Cannot get type of device");
 
   printf ("Using Device %d : %s [%s]\n", dev, (dtype == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", name);
 
-  if (graphics_display_enabled ()) {
+  // Partage avec OpenGL seulement si l'affichage passe par OpenCL
+  // (la version hybride, par exemple, relit ses lignes dans image)
+  if (graphics_display_enabled () && opencl_used) {
 #ifdef __APPLE__
     CGLContextObj cgl_context = CGLGetCurrentContext ();
     CGLShareGroupObj sharegroup = CGLGetShareGroup (cgl_context);
@@ -193,57 +573,7 @@ void ocl_init (void)
 
   check (err, "Failed to create compute context");
 
-  // Load program source into memory
-  //
-  const char	*opencl_prog;
-  opencl_prog = file_load ("kernel/compute.cl");
-
-  // Attach program source to context
-  //
-  program = clCreateProgramWithSource (context, 1, &opencl_prog, NULL, &err);
-  check (err, "Failed to create program");
-
-  // Compile program
-  //
-  {
-    char flags[1024];
-
-    sprintf (flags,
-	     "-cl-mad-enable -cl-fast-relaxed-math -DDIM=%d -DSIZE=%d -DTILEX=%d -DTILEY=%d",
-	     DIM, SIZE, TILEX, TILEY);
-
-    err = clBuildProgram (program, 0, NULL, flags, NULL, NULL);
-    // Display compiler log
-    //
-    {
-      size_t len;
-
-      clGetProgramBuildInfo (program, devices [dev], CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-
-      if (len > 1) {
-	char buffer[len];
-
-	fprintf (stderr, "--- OpenCL Compiler log ---\n");
-	clGetProgramBuildInfo (program, devices [dev], CL_PROGRAM_BUILD_LOG,
-			       sizeof (buffer), buffer, NULL);
-	fprintf (stderr, "%s\n", buffer);
-	fprintf (stderr, "---------------------------\n");
-      }
-    }
-    
-    if(err != CL_SUCCESS)
-      exit_with_error ("Failed to build program!\n");
-  }
-
-  // Create the compute kernel in the program we wish to run
-  //
-  compute_kernel = clCreateKernel (program, kernel_name, &err);
-  check (err, "Failed to create compute kernel");
-
-  printf ("Using kernel: %s\n", kernel_name);
-  
-  update_kernel = clCreateKernel (program, "update_texture", &err);
-  check (err, "Failed to create compute kernel");
+  ocl_build_program ();
 
   // Create a command queue
   //
@@ -252,12 +582,25 @@ void ocl_init (void)
 
   // Allocate buffers inside device memory
   //
-  cur_buffer = clCreateBuffer (context, CL_MEM_READ_WRITE, sizeof(unsigned) * DIM * DIM,
+  // Sans affichage, les images ne quittent le périphérique que par
+  // projection (map) : si le périphérique partage la mémoire de l'hôte,
+  // on lui demande des tampons directement accessibles, sans copie.
+  // Sur un GPU à mémoire séparée, le noyau écrirait à travers le bus : on
+  // garde alors des tampons en mémoire du périphérique.
+  {
+    cl_bool unified = CL_FALSE;
+
+    clGetDeviceInfo (device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof (unified), &unified, NULL);
+    if (!graphics_display_enabled () && (dtype == CL_DEVICE_TYPE_CPU || unified))
+      buffer_flags |= CL_MEM_ALLOC_HOST_PTR;
+  }
+
+  cur_buffer = clCreateBuffer (context, buffer_flags, sizeof(unsigned) * DIM * DIM,
 			       NULL, NULL);
   if (!cur_buffer)
     exit_with_error ("Failed to allocate input buffer");
 
-  next_buffer = clCreateBuffer (context, CL_MEM_READ_WRITE, sizeof(unsigned) * DIM * DIM,
+  next_buffer = clCreateBuffer (context, buffer_flags, sizeof(unsigned) * DIM * DIM,
 				NULL, NULL);
   if (!next_buffer)
     exit_with_error ("Failed to allocate output buffer");
@@ -273,14 +616,34 @@ void ocl_map_textures (GLuint texid)
   check (err, "Failed to map texture buffer\n");
 }
 
+static void ocl_fill_buffer (cl_mem buffer, unsigned *image)
+{
+  unsigned *p = clEnqueueMapBuffer (queue, buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+				    0, sizeof (unsigned) * DIM * DIM, 0, NULL,
+				    ocl_event ("map_buffer"), &err);
+  check (err, "Failed to map buffer");
+
+  memcpy (p, image, sizeof (unsigned) * DIM * DIM);
+
+  err = clEnqueueUnmapMemObject (queue, buffer, p, 0, NULL, ocl_event ("unmap_buffer"));
+  check (err, "Failed to unmap buffer");
+}
+
 void ocl_send_image (unsigned *image)
 {
+  if (!graphics_display_enabled ()) {
+    ocl_fill_buffer (cur_buffer, image);
+    ocl_fill_buffer (next_buffer, image);
+    PRINT_DEBUG ('o', "Initial image mapped into device buffers.\n");
+    return;
+  }
+
   err = clEnqueueWriteBuffer (queue, cur_buffer, CL_TRUE, 0,
-			      sizeof (unsigned) * DIM * DIM, image, 0, NULL, NULL);
+			      sizeof (unsigned) * DIM * DIM, image, 0, NULL, ocl_event ("write_buffer"));
   check (err, "Failed to write to cur_buffer");
 
   err = clEnqueueWriteBuffer (queue, next_buffer, CL_TRUE, 0,
-			      sizeof (unsigned) * DIM * DIM, image, 0, NULL, NULL);
+			      sizeof (unsigned) * DIM * DIM, image, 0, NULL, ocl_event ("write_buffer"));
   check (err, "Failed to write to next_buffer");
 
   PRINT_DEBUG ('o', "Initial image sent to device.\n");
@@ -301,7 +664,7 @@ unsigned ocl_compute (unsigned nb_iter)
     check (err, "Failed to set kernel arguments");
 
     err = clEnqueueNDRangeKernel (queue, compute_kernel, 2, NULL, global, local,
-				  0, NULL, NULL);
+				  0, NULL, ocl_event (kernel_name));
     check (err, "Failed to execute kernel");
 
     // Swap buffers
@@ -312,11 +675,93 @@ unsigned ocl_compute (unsigned nb_iter)
   return 0;
 }
 
+// Relecture des images sans affichage : seule la dernière image est
+// rapatriée (ocl_readback_flush) ; les lots intermédiaires ne le sont que
+// si on les lit (empreintes de -d k). Dans ce cas, après chaque appel à
+// the_compute, cur_buffer est projeté en lecture de façon non bloquante.
+// Si la version alterne ses tampons à chaque lot (ocl_pingpong), l'image
+// n'est consommée qu'au lot suivant, pendant que le périphérique calcule
+// dans l'autre tampon ; sinon elle est consommée tout de suite.
+
+unsigned ocl_pingpong = 0;
+
+struct mapping {
+  cl_mem buffer;
+  unsigned *ptr;
+  cl_event ready;
+};
+
+static struct mapping readback = { NULL, NULL, NULL };
+static unsigned long frames_read = 0;
+
+static void ocl_map_image (struct mapping *m)
+{
+  m->buffer = cur_buffer;
+  m->ptr = clEnqueueMapBuffer (queue, cur_buffer, CL_FALSE, CL_MAP_READ,
+			       0, sizeof (unsigned) * DIM * DIM, 0, NULL, &m->ready, &err);
+  check (err, "Failed to map image");
+  clFlush (queue);
+}
+
+static void ocl_consume_image (struct mapping *m, int keep)
+{
+  err = clWaitForEvents (1, &m->ready);
+  check (err, "Failed to map image");
+  clReleaseEvent (m->ready);
+
+  frames_read++;
+  if (debug_enabled ('k'))
+    PRINT_DEBUG ('k', "frame batch %lu: checksum %016llx\n", frames_read,
+		 (unsigned long long) hash_bytes (HASH_INIT, m->ptr,
+						  sizeof (unsigned) * DIM * DIM));
+
+  // Dernière image : on la laisse dans image, comme en mode graphique
+  if (keep)
+    memcpy (image, m->ptr, sizeof (unsigned) * DIM * DIM);
+
+  err = clEnqueueUnmapMemObject (queue, m->buffer, m->ptr, 0, NULL,
+				 ocl_event ("unmap_image"));
+  check (err, "Failed to unmap image");
+
+  m->ptr = NULL;
+}
+
+void ocl_readback (void)
+{
+  struct mapping prev = readback;
+
+  // Sur un GPU discret, chaque projection est une copie de DIM x DIM
+  // pixels : inutile si personne ne lit l'image
+  if (!debug_enabled ('k'))
+    return;
+
+  ocl_map_image (&readback);
+
+  // Le lot précédent, dans l'autre tampon, est traité pendant ce temps
+  if (prev.ptr != NULL)
+    ocl_consume_image (&prev, 0);
+
+  if (!ocl_pingpong)
+    ocl_consume_image (&readback, 0);
+}
+
+void ocl_readback_flush (void)
+{
+  if (readback.ptr == NULL)
+    ocl_map_image (&readback);
+
+  ocl_consume_image (&readback, 1);
+  clFinish (queue);
+}
+
 void ocl_wait (void)
 {
   // Wait for the command commands to get serviced before reading back results
   //
   clFinish (queue);
+
+  if (nb_pending > 0)
+    ocl_profiling_flush ();
 }
 
 void ocl_update_texture (void)
@@ -334,7 +779,7 @@ void ocl_update_texture (void)
   check (err, "Failed to set kernel arguments");
 
   err = clEnqueueNDRangeKernel (queue, update_kernel, 2, NULL, global, local,
-			       0, NULL, NULL);
+			       0, NULL, ocl_event ("update_texture"));
   check(err, "Failed to execute kernel");
 
   ocl_release ();
@@ -0,0 +1,315 @@
+
+// Outil OMPT intégré au programme : avec un support d'exécution OpenMP qui
+// implémente OMPT (libomp de LLVM : make CC=clang), et si la variable
+// OMPT_TRACE=<fichier> est définie, on enregistre pour chaque thread les
+// régions parallèles, boucles partagées, paquets d'itérations, tâches et
+// attentes aux barrières. En fin d'exécution : bilan du déséquilibre de
+// charge sur stderr et trace détaillée (CSV) dans <fichier>.
+//
+// Avec GCC (libgomp, sans OMPT), ce fichier est vide.
+
+#if defined(__has_include)
+#if __has_include(<omp-tools.h>)
+#define HAVE_OMPT
+#endif
+#endif
+
+#ifdef HAVE_OMPT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp-tools.h>
+
+#include "timing.h"
+
+#define MAX_THREADS      512
+#define DEFAULT_MAX_EVTS (1 << 20) // par thread, au-delà on ne fait que compter
+
+enum {
+  EV_IMPLICIT,   // participation d'un thread à une région parallèle
+  EV_LOOP,       // boucle partagée (omp for)
+  EV_CHUNK,      // paquet d'itérations attribué (instantané)
+  EV_TASK,       // exécution d'une tâche explicite
+  EV_WAIT,       // attente (barrière, taskwait, taskgroup)
+  NB_EVENTS
+};
+
+static const char *event_name [NB_EVENTS] = { "region", "loop", "chunk", "task", "wait" };
+
+struct event {
+  uint64_t start, end;
+  uint32_t region;
+  uint16_t kind;
+  uint64_t arg;
+};
+
+struct ompt_thread {
+  int id;
+  uint64_t busy, wait, chunks, tasks_created, tasks_run, regions;
+  uint64_t implicit_start, wait_start, task_start, loop_start;
+  uint64_t wait_tasks; // tâches exécutées pendant une attente : temps utile
+  int in_wait;
+  uint32_t region;
+  struct event *events;
+  size_t nb, cap;
+};
+
+static struct ompt_thread *threads [MAX_THREADS];
+static int nb_threads = 0;
+static __thread struct ompt_thread *self = NULL;
+
+static uint32_t nb_regions = 0;
+static uint64_t origin;
+static size_t max_events = DEFAULT_MAX_EVTS;
+static char *trace_file = NULL;
+
+static void record (int kind, uint64_t start, uint64_t end, uint64_t arg)
+{
+  struct event *e;
+
+  if (self->nb == self->cap) {
+    if (self->cap >= max_events)
+      return;
+    self->cap = self->cap ? self->cap * 2 : 4096;
+    self->events = realloc (self->events, self->cap * sizeof (struct event));
+  }
+
+  e = &self->events [self->nb++];
+  e->start = start;
+  e->end = end;
+  e->region = self->region;
+  e->kind = kind;
+  e->arg = arg;
+}
+
+static void on_thread_begin (ompt_thread_t type, ompt_data_t *thread_data)
+{
+  int id = __atomic_fetch_add (&nb_threads, 1, __ATOMIC_RELAXED);
+
+  if (id >= MAX_THREADS)
+    return;
+
+  self = calloc (1, sizeof (struct ompt_thread));
+  self->id = id;
+  threads [id] = self;
+  thread_data->ptr = self;
+}
+
+static void on_parallel_begin (ompt_data_t *encountering_task_data,
+			       const ompt_frame_t *encountering_task_frame,
+			       ompt_data_t *parallel_data, unsigned requested_parallelism,
+			       int flags, const void *codeptr_ra)
+{
+  parallel_data->value = __atomic_add_fetch (&nb_regions, 1, __ATOMIC_RELAXED);
+}
+
+static void on_implicit_task (ompt_scope_endpoint_t endpoint, ompt_data_t *parallel_data,
+			      ompt_data_t *task_data, unsigned actual_parallelism,
+			      unsigned index, int flags)
+{
+  uint64_t now = timing_stamp ();
+
+  if (self == NULL || (flags & ompt_task_initial))
+    return;
+
+  if (endpoint == ompt_scope_begin) {
+    task_data->value = ompt_task_implicit;
+    // parallel_data vaut NULL en fin de tâche implicite : on garde le numéro
+    self->region = parallel_data != NULL ? parallel_data->value : 0;
+    self->implicit_start = now;
+    self->regions++;
+  } else {
+    self->busy += now - self->implicit_start;
+    record (EV_IMPLICIT, self->implicit_start, now, index);
+  }
+}
+
+static void on_work (ompt_work_t wstype, ompt_scope_endpoint_t endpoint,
+		     ompt_data_t *parallel_data, ompt_data_t *task_data,
+		     uint64_t count, const void *codeptr_ra)
+{
+  uint64_t now = timing_stamp ();
+
+  if (self == NULL || wstype != ompt_work_loop)
+    return;
+
+  if (endpoint == ompt_scope_begin)
+    self->loop_start = now;
+  else
+    record (EV_LOOP, self->loop_start, now, count);
+}
+
+static void on_dispatch (ompt_data_t *parallel_data, ompt_data_t *task_data,
+			 ompt_dispatch_t kind, ompt_data_t instance)
+{
+  uint64_t now = timing_stamp ();
+
+  if (self == NULL)
+    return;
+
+  self->chunks++;
+  record (EV_CHUNK, now, now, instance.value);
+}
+
+static void on_task_create (ompt_data_t *encountering_task_data,
+			    const ompt_frame_t *encountering_task_frame,
+			    ompt_data_t *new_task_data, int flags, int has_dependences,
+			    const void *codeptr_ra)
+{
+  new_task_data->value = flags;
+  if (self != NULL && (flags & ompt_task_explicit))
+    self->tasks_created++;
+}
+
+static void on_task_schedule (ompt_data_t *prior_task_data, ompt_task_status_t prior_task_status,
+			      ompt_data_t *next_task_data)
+{
+  uint64_t now = timing_stamp ();
+
+  if (self == NULL)
+    return;
+
+  if (prior_task_data != NULL && (prior_task_data->value & ompt_task_explicit)
+      && self->task_start != 0) {
+    if (self->in_wait)
+      self->wait_tasks += now - self->task_start;
+    record (EV_TASK, self->task_start, now, 0);
+    self->task_start = 0;
+  }
+
+  if (next_task_data != NULL && (next_task_data->value & ompt_task_explicit)) {
+    self->task_start = now;
+    self->tasks_run++;
+  }
+}
+
+static void on_sync_region_wait (ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint,
+				 ompt_data_t *parallel_data, ompt_data_t *task_data,
+				 const void *codeptr_ra)
+{
+  uint64_t now = timing_stamp ();
+
+  if (self == NULL)
+    return;
+
+  if (endpoint == ompt_scope_begin) {
+    self->wait_start = now;
+    self->in_wait = 1;
+  } else {
+    self->in_wait = 0;
+    self->wait += now - self->wait_start;
+    record (EV_WAIT, self->wait_start, now, kind);
+  }
+}
+
+static void write_trace (void)
+{
+  FILE *f = fopen (trace_file, "w");
+
+  if (f == NULL) {
+    perror (trace_file);
+    return;
+  }
+
+  fprintf (f, "thread,event,region,start_ns,end_ns,arg\n");
+  for (int t = 0; t < nb_threads && t < MAX_THREADS; t++)
+    if (threads [t] != NULL)
+      for (size_t i = 0; i < threads [t]->nb; i++) {
+	struct event *e = &threads [t]->events [i];
+
+	fprintf (f, "%d,%s,%u,%lu,%lu,%lu\n", t, event_name [e->kind], e->region,
+		 (unsigned long) timing_ns (origin, e->start),
+		 (unsigned long) timing_ns (origin, e->end), (unsigned long) e->arg);
+      }
+
+  fclose (f);
+}
+
+// Temps utile = présence dans les régions parallèles - attentes (hors
+// tâches exécutées pendant ces attentes) ;
+// déséquilibre = max / moyenne des temps utiles des threads
+static void print_summary (void)
+{
+  double sum = 0.0, max = 0.0;
+  int n = 0;
+
+  fprintf (stderr, "\nOMPT summary (%u parallel regions):\n", nb_regions);
+  fprintf (stderr, "  thread   regions   busy (ms)   wait (ms)  wait %%   chunks  tasks (created/run)\n");
+
+  for (int t = 0; t < nb_threads && t < MAX_THREADS; t++) {
+    struct ompt_thread *th = threads [t];
+    double busy, wait;
+
+    if (th == NULL || th->regions == 0)
+      continue;
+
+    wait = timing_ns (0, th->wait - th->wait_tasks) * 1e-6;
+    busy = timing_ns (0, th->busy) * 1e-6 - wait;
+
+    fprintf (stderr, "  %6d %9lu %11.3f %11.3f %6.1f %8lu %8lu/%lu\n", t,
+	     (unsigned long) th->regions, busy, wait,
+	     busy + wait > 0 ? 100.0 * wait / (busy + wait) : 0.0,
+	     (unsigned long) th->chunks, (unsigned long) th->tasks_created,
+	     (unsigned long) th->tasks_run);
+
+    sum += busy;
+    max = busy > max ? busy : max;
+    n++;
+  }
+
+  if (n > 0 && sum > 0)
+    fprintf (stderr, "  load imbalance (max / mean busy time): %.3f over %d threads\n",
+	     max / (sum / n), n);
+}
+
+static int tool_initialize (ompt_function_lookup_t lookup, int initial_device_num,
+			    ompt_data_t *tool_data)
+{
+  ompt_set_callback_t set_callback = (ompt_set_callback_t) lookup ("ompt_set_callback");
+  char *str = getenv ("OMPT_TRACE_MAX");
+
+  if (str != NULL)
+    max_events = atol (str);
+
+  timing_init ();
+  origin = timing_stamp ();
+
+#define REGISTER(event, fun)						\
+  if (set_callback (event, (ompt_callback_t) fun) == ompt_set_never)	\
+    fprintf (stderr, "OMPT: callback " #event " unavailable\n")
+
+  REGISTER (ompt_callback_thread_begin, on_thread_begin);
+  REGISTER (ompt_callback_parallel_begin, on_parallel_begin);
+  REGISTER (ompt_callback_implicit_task, on_implicit_task);
+  REGISTER (ompt_callback_work, on_work);
+  REGISTER (ompt_callback_dispatch, on_dispatch);
+  REGISTER (ompt_callback_task_create, on_task_create);
+  REGISTER (ompt_callback_task_schedule, on_task_schedule);
+  REGISTER (ompt_callback_sync_region_wait, on_sync_region_wait);
+
+  return 1;
+}
+
+static void tool_finalize (ompt_data_t *tool_data)
+{
+  print_summary ();
+  write_trace ();
+  fprintf (stderr, "OMPT trace written to %s\n", trace_file);
+}
+
+// Point d'entrée recherché par le support d'exécution OpenMP au démarrage
+ompt_start_tool_result_t *ompt_start_tool (unsigned int omp_version,
+					   const char *runtime_version)
+{
+  static ompt_start_tool_result_t result = { tool_initialize, tool_finalize, { 0 } };
+
+  trace_file = getenv ("OMPT_TRACE");
+  if (trace_file == NULL)
+    return NULL; // outil inactif : aucun surcoût
+
+  fprintf (stderr, "OMPT tool attached to %s\n", runtime_version);
+  return &result;
+}
+
+#endif
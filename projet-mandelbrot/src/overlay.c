@@ -0,0 +1,116 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "overlay.h"
+
+#define OVERLAY_ALPHA 128
+
+unsigned overlay_mode = OVERLAY_OFF;
+
+struct tile_stat {
+  uint64_t ns;
+  unsigned worker;
+};
+
+static struct tile_stat *tiles = NULL;
+static unsigned tiles_grain = 0;
+
+static const char *mode_name [OVERLAY_NB_MODES] = { "off", "tile cost", "worker" };
+
+static Uint32 worker_color [7] = {
+  0x00F9F9FF,           // Cyan
+  0xAE4AFFFF,           // Purple
+  0x66CCFFFF,           // Sky Blue
+  0xFF6666FF,           // Salmon
+  0xFFFF00FF,           // Yellow
+  0xFF7426FF,           // Orange
+  0x00FF00FF,           // Green
+};
+
+void overlay_next_mode (void)
+{
+  overlay_mode = (overlay_mode + 1) % OVERLAY_NB_MODES;
+  printf ("\noverlay: %s\n", mode_name [overlay_mode]);
+}
+
+// Appelé hors région parallèle : la table suit le grain courant
+void overlay_begin (unsigned grain)
+{
+  if (overlay_mode == OVERLAY_OFF || grain == tiles_grain)
+    return;
+
+  free (tiles);
+  tiles = calloc ((size_t) grain * grain, sizeof (struct tile_stat));
+  tiles_grain = grain;
+}
+
+// Chaque tuile n'est calculée que par un thread par image : pas de verrou
+void overlay_store (unsigned i, unsigned j, uint64_t start, unsigned worker)
+{
+  struct tile_stat *t;
+
+  if (tiles == NULL || i >= tiles_grain || j >= tiles_grain)
+    return;
+
+  t = &tiles [i * tiles_grain + j];
+  t->ns = timing_ns (start, timing_stamp ());
+  t->worker = worker;
+}
+
+// Rampe bleu -> cyan -> vert -> jaune -> rouge, x dans [0, 1]
+static Uint32 heat_color (float x)
+{
+  float r = x < 0.5f ? 0.0f : (x < 0.75f ? (x - 0.5f) * 4 : 1.0f);
+  float g = x < 0.25f ? x * 4 : (x < 0.75f ? 1.0f : (1.0f - x) * 4);
+  float b = x < 0.25f ? 1.0f : (x < 0.5f ? (0.5f - x) * 4 : 0.0f);
+
+  return ((Uint32) (r * 255) << 24) | ((Uint32) (g * 255) << 16) | ((Uint32) (b * 255) << 8);
+}
+
+void overlay_draw (SDL_Renderer *ren, int width, int height)
+{
+  uint64_t min = UINT64_MAX, max = 0;
+  unsigned n = tiles_grain;
+
+  if (overlay_mode == OVERLAY_OFF || tiles == NULL)
+    return;
+
+  for (unsigned t = 0; t < n * n; t++)
+    if (tiles [t].ns > 0) {
+      min = tiles [t].ns < min ? tiles [t].ns : min;
+      max = tiles [t].ns > max ? tiles [t].ns : max;
+    }
+
+  if (max == 0)
+    return;
+
+  SDL_SetRenderDrawBlendMode (ren, SDL_BLENDMODE_BLEND);
+
+  for (unsigned i = 0; i < n; i++)
+    for (unsigned j = 0; j < n; j++) {
+      struct tile_stat *t = &tiles [i * n + j];
+      Uint32 c;
+      SDL_Rect r;
+
+      if (t->ns == 0)
+	continue;
+
+      if (overlay_mode == OVERLAY_COST)
+	c = heat_color (max > min ? (float) (t->ns - min) / (max - min) : 0.0f);
+      else
+	c = worker_color [t->worker % 7];
+
+      // Mêmes bornes que les tuiles du noyau, ramenées à la fenêtre
+      r.x = (long) j * DIM / n * width / DIM;
+      r.y = (long) i * DIM / n * height / DIM;
+      r.w = (long) (j + 1) * DIM / n * width / DIM - r.x;
+      r.h = (long) (i + 1) * DIM / n * height / DIM - r.y;
+
+      SDL_SetRenderDrawColor (ren, c >> 24, (c >> 16) & 0xFF, (c >> 8) & 0xFF, OVERLAY_ALPHA);
+      SDL_RenderFillRect (ren, &r);
+    }
+
+  SDL_SetRenderDrawBlendMode (ren, SDL_BLENDMODE_NONE);
+}
@@ -0,0 +1,238 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "debug.h"
+#include "perfctr.h"
+
+#define MAX_THREADS 256
+
+unsigned perfctr_enabled = 0;
+
+const char *perfctr_name [PERFCTR_NB] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "stalled_backend"
+};
+
+struct perf_thread {
+  int used;
+  char label [32];
+  int fd [PERFCTR_NB];
+  double start [PERFCTR_NB];
+};
+
+static struct perf_thread threads [MAX_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct perf_thread *me = NULL;
+
+static double total [PERFCTR_NB];
+static int available [PERFCTR_NB];
+
+#ifdef __linux__
+
+static const struct {
+  __u32 type;
+  __u64 config;
+} events [PERFCTR_NB] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+};
+
+static int open_counter (int e)
+{
+  struct perf_event_attr attr;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = events [e].type;
+  attr.config = events [e].config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Plus de compteurs demandés que de registres : le noyau les fait
+  // tourner, on corrige par le rapport temps actif / temps total
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  // Thread appelant, sur n'importe quel cœur
+  return syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double read_counter (int fd)
+{
+  __u64 v [3];
+
+  if (read (fd, v, sizeof (v)) != sizeof (v) || v [2] == 0)
+    return 0.0;
+
+  return (double) v [0] * v [1] / v [2];
+}
+
+#else
+
+static int open_counter (int e)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+static double read_counter (int fd)
+{
+  return 0.0;
+}
+
+#endif
+
+void perfctr_init (void)
+{
+  int fd, any = 0;
+
+  if (!debug_enabled ('h'))
+    return;
+
+  // Sonde : quels compteurs ce thread peut-il ouvrir ?
+  for (int e = 0; e < PERFCTR_NB; e++) {
+    fd = open_counter (e);
+    available [e] = (fd >= 0);
+    if (fd >= 0) {
+      close (fd);
+      any = 1;
+    } else
+      PRINT_DEBUG ('h', "Counter %s unavailable: %s\n", perfctr_name [e], strerror (errno));
+  }
+
+  if (!any) {
+    fprintf (stderr, "Warning: no hardware counter available, 'h' debug flag ignored\n");
+    return;
+  }
+
+  perfctr_enabled = 1;
+  perfctr_reset ();
+}
+
+// Appelé par chaque thread de calcul, une seule fois
+void perfctr_register (const char *kind, int id)
+{
+  if (!perfctr_enabled || me != NULL)
+    return;
+
+  pthread_mutex_lock (&lock);
+  for (int t = 0; t < MAX_THREADS; t++)
+    if (!threads [t].used) {
+      me = &threads [t];
+      me->used = 1;
+      break;
+    }
+  pthread_mutex_unlock (&lock);
+
+  if (me == NULL)
+    return;
+
+  snprintf (me->label, sizeof (me->label), "%s %d", kind, id);
+  for (int e = 0; e < PERFCTR_NB; e++)
+    me->fd [e] = available [e] ? open_counter (e) : -1;
+}
+
+void perfctr_unregister (void)
+{
+  if (me == NULL)
+    return;
+
+  for (int e = 0; e < PERFCTR_NB; e++)
+    if (me->fd [e] >= 0)
+      close (me->fd [e]);
+
+  pthread_mutex_lock (&lock);
+  me->used = 0;
+  pthread_mutex_unlock (&lock);
+
+  me = NULL;
+}
+
+void perfctr_begin (void)
+{
+  if (!perfctr_enabled)
+    return;
+
+  // Les threads OpenMP apparaissent au premier parallel : on les
+  // enregistre ici (sans effet pour ceux qui le sont déjà)
+  #pragma omp parallel
+  perfctr_register ("omp", omp_get_thread_num ());
+
+  pthread_mutex_lock (&lock);
+  for (int t = 0; t < MAX_THREADS; t++)
+    if (threads [t].used)
+      for (int e = 0; e < PERFCTR_NB; e++)
+	if (threads [t].fd [e] >= 0)
+	  threads [t].start [e] = read_counter (threads [t].fd [e]);
+  pthread_mutex_unlock (&lock);
+}
+
+static void print_counters (const char *label, double c [PERFCTR_NB])
+{
+  fprintf (stderr, "  %-10s", label);
+  for (int e = 0; e < PERFCTR_NB; e++)
+    if (available [e])
+      fprintf (stderr, " %s %-10.4g", perfctr_name [e], c [e]);
+  if (available [PERFCTR_CYCLES] && available [PERFCTR_INSTRUCTIONS] && c [PERFCTR_CYCLES] > 0)
+    fprintf (stderr, " IPC %.2f", c [PERFCTR_INSTRUCTIONS] / c [PERFCTR_CYCLES]);
+  fprintf (stderr, "\n");
+}
+
+void perfctr_end (unsigned frames)
+{
+  double sum [PERFCTR_NB] = { 0 };
+
+  if (!perfctr_enabled)
+    return;
+
+  fprintf (stderr, "Hardware counters (%u frame%s):\n", frames, frames > 1 ? "s" : "");
+
+  pthread_mutex_lock (&lock);
+  for (int t = 0; t < MAX_THREADS; t++)
+    if (threads [t].used) {
+      double c [PERFCTR_NB] = { 0 };
+
+      for (int e = 0; e < PERFCTR_NB; e++)
+	if (threads [t].fd [e] >= 0) {
+	  c [e] = read_counter (threads [t].fd [e]) - threads [t].start [e];
+	  sum [e] += c [e];
+	}
+
+      // Threads inactifs (ex : threads OpenMP pendant sched) : rien à dire
+      if (c [PERFCTR_INSTRUCTIONS] > 0 || c [PERFCTR_CYCLES] > 0)
+	print_counters (threads [t].label, c);
+    }
+  pthread_mutex_unlock (&lock);
+
+  print_counters ("total", sum);
+
+  for (int e = 0; e < PERFCTR_NB; e++)
+    total [e] += sum [e];
+}
+
+void perfctr_reset (void)
+{
+  for (int e = 0; e < PERFCTR_NB; e++)
+    total [e] = 0.0;
+}
+
+void perfctr_totals (double t [PERFCTR_NB])
+{
+  for (int e = 0; e < PERFCTR_NB; e++)
+    t [e] = (perfctr_enabled && available [e]) ? total [e] : -1.0;
+}
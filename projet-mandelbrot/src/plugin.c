@@ -0,0 +1,95 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "constants.h"
+#include "error.h"
+#include "debug.h"
+#include "plugin.h"
+
+#define DEFAULT_PLUGIN_DIR "plugins"
+
+char *plugin_isa = NULL;
+
+// Du plus performant au plus courant ; les noms sont ceux de -march
+static const char *isa_levels [] = {
+#if defined(__x86_64__)
+  "x86-64-v4", // AVX-512 (F, BW, CD, DQ, VL)
+  "x86-64-v3", // AVX2, FMA, BMI2
+  "x86-64",
+#endif
+  NULL
+};
+
+static int isa_supported (const char *isa)
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init ();
+
+  if (!strcmp (isa, "x86-64-v4"))
+    return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw")
+      && __builtin_cpu_supports ("avx512cd") && __builtin_cpu_supports ("avx512dq")
+      && __builtin_cpu_supports ("avx512vl") && isa_supported ("x86-64-v3");
+
+  if (!strcmp (isa, "x86-64-v3"))
+    return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma")
+      && __builtin_cpu_supports ("bmi2");
+
+  return !strcmp (isa, "x86-64");
+#else
+  return 0;
+#endif
+}
+
+// 1 si le greffon a été chargé, 0 s'il n'existe pas
+static int try_load (const char *dir, const char *kernel, const char *isa)
+{
+  char path [1024];
+
+  snprintf (path, sizeof (path), "%s/%s.%s.so", dir, kernel, isa);
+  if (access (path, R_OK) < 0) {
+    PRINT_DEBUG ('g', "No plugin %s\n", path);
+    return 0;
+  }
+
+  // RTLD_NOW : un symbole de prog manquant est signalé ici, pas en plein calcul
+  if (dlopen (path, RTLD_NOW | RTLD_LOCAL) == NULL) {
+    fprintf (stderr, "Warning: cannot load plugin %s: %s\n", path, dlerror ());
+    return 0;
+  }
+
+  printf ("Using plugin %s\n", path);
+  return 1;
+}
+
+void plugin_load (void)
+{
+  char *kernel = getenv ("KERNEL"), *dir = getenv ("PLUGIN_DIR");
+
+  if (kernel == NULL)
+    kernel = DEFAULT_KERNEL;
+  if (dir == NULL)
+    dir = DEFAULT_PLUGIN_DIR;
+
+  if (plugin_isa != NULL) {
+    if (!strcmp (plugin_isa, "builtin"))
+      return;
+
+    if (!isa_supported (plugin_isa))
+      exit_with_error ("ISA level %s is not supported by this CPU\n", plugin_isa);
+    if (!try_load (dir, kernel, plugin_isa))
+      exit_with_error ("No usable plugin %s/%s.%s.so (make plugins)\n", dir, kernel, plugin_isa);
+    return;
+  }
+
+  for (int i = 0; isa_levels [i] != NULL; i++)
+    if (isa_supported (isa_levels [i]) && try_load (dir, kernel, isa_levels [i])) {
+      plugin_isa = (char *) isa_levels [i];
+      return;
+    }
+
+  plugin_isa = "builtin";
+}
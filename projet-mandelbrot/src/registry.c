@@ -0,0 +1,44 @@
+
+#include <string.h>
+
+#include "registry.h"
+
+#define MAX_KERNELS 32
+
+static kernel_desc_t *kernels [MAX_KERNELS];
+static unsigned nb_kernels = 0;
+
+version_desc_t *the_version = NULL;
+
+// Appelé par les constructeurs, avant main ou au chargement d'un
+// greffon : un noyau déjà présent (compilé dans prog) est remplacé, un
+// noyau en trop est simplement ignoré
+void registry_add (kernel_desc_t *k)
+{
+  for (unsigned i = 0; i < nb_kernels; i++)
+    if (!strcmp (kernels [i]->name, k->name)) {
+      kernels [i] = k;
+      return;
+    }
+
+  if (nb_kernels < MAX_KERNELS)
+    kernels [nb_kernels++] = k;
+}
+
+kernel_desc_t *registry_kernel (const char *name)
+{
+  for (unsigned i = 0; i < nb_kernels; i++)
+    if (!strcmp (kernels [i]->name, name))
+      return kernels [i];
+
+  return NULL;
+}
+
+version_desc_t *registry_version (kernel_desc_t *k, const char *version)
+{
+  for (version_desc_t *v = k->versions; v->name != NULL; v++)
+    if (!strcmp (v->name, version))
+      return v;
+
+  return NULL;
+}
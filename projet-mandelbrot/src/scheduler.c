@@ -8,6 +8,7 @@
 
 #include "scheduler.h"
 #include "debug.h"
+#include "perfctr.h"
 
 static int nbWorkers;
 
@@ -67,6 +68,9 @@ static void add_task (struct task todo, int w)
 {
   one_more_task ();
   pthread_mutex_lock (&workers[w].mutex);
+  // File pleine : on attend que l'ouvrier en ait retiré une tâche
+  while ((workers[w].f + 1) % WORK_QUEUE == workers[w].d)
+    pthread_cond_wait (&workers[w].cond, &workers[w].mutex);
   workers[w].tasks[workers[w].f] = todo;
   workers[w].f = (workers[w].f + 1) % WORK_QUEUE;
   workers[w].todo++;
@@ -108,31 +112,40 @@ static void *worker_main (void *p)
   hwloc_obj_t obj;
   hwloc_bitmap_t set;
 
-  obj = hwloc_get_obj_by_type (topology, HWLOC_OBJ_PU, me->id);
+  obj = hwloc_get_obj_by_type (topology, HWLOC_OBJ_PU, me->id % nb_cores);
   set = obj->cpuset;
   hwloc_bitmap_singlify (set);
   hwloc_set_cpubind (topology, set, HWLOC_CPUBIND_THREAD);
 
   PRINT_DEBUG ('s', "Hey, I'm worker %d\n", me->id);
+
+  perfctr_register ("sched", me->id);
   
   while (1) {
+    int done = 0;
     
     pthread_mutex_lock (&me->mutex);
     
-    if (me->d == me->f && me->fin == 0)
+    // cond sert aussi aux producteurs (file pleine) : réveil possible
+    // sans tâche ni fin, on revérifie
+    while (me->d == me->f && me->fin == 0)
       pthread_cond_wait (&me->cond, &me->mutex);
     
     if (me->d != me->f) {
       todo = me->tasks[me->d];
       me->d = (me->d + 1) % WORK_QUEUE;
       me->todo--;
-    } else if (me->fin == 1)
+      pthread_cond_signal (&me->cond);
+    } else {
       me->fin = -1;
+      done = 1;
+    }
     
     pthread_mutex_unlock(&me->mutex);
     
-    if (me->fin == -1) {
+    if (done) {
       PRINT_DEBUG ('s', "Worker %d has computed %d tasks\n", me->id, tasks);
+      perfctr_unregister ();
       return NULL;
     }
 
@@ -5,6 +5,9 @@
 #include "debug.h"
 #include "ocl.h"
 #include "scheduler.h"
+#include "tuning.h"
+#include "registry.h"
+#include "first_touch.h"
 
 #include <stdbool.h>
 
@@ -37,24 +40,66 @@ unsigned scrollup_compute_omp (unsigned nb_iter)
       for (int j = 0; j < DIM; j++)
    	next_img (i, j) = (i == DIM - 1) ? cur_img (0, j) : cur_img (i + 1, j);
 
+    // Un seul échange, visible de tous après la barrière de single
+    #pragma omp single
     swap_images ();
   }
 
   return 0;
 }
 
+static unsigned omp_d_chunk = 10;
+
 unsigned scrollup_compute_omp_d (unsigned nb_iter)
 {
   #pragma omp parallel
   for (unsigned it = 1; it <= nb_iter; it ++) {
  
-    #pragma omp for schedule(dynamic,10)
+    #pragma omp for schedule(dynamic,omp_d_chunk)
     for (int i = 0; i < DIM; i++)
       for (int j = 0; j < DIM; j++)
    	next_img (i, j) = (i == DIM - 1) ? cur_img (0, j) : cur_img (i + 1, j);
 
+    #pragma omp single
     swap_images ();
   }
 
   return 0;
 }
+
+
+// Premier accès (-ft) : blocs de lignes pour omp, paquets cycliques de
+// omp_d_chunk lignes pour omp_d
+static void scrollup_ft_omp (void)
+{
+  first_touch_rows (0);
+}
+
+static void scrollup_ft_omp_d (void)
+{
+  first_touch_rows (omp_d_chunk);
+}
+
+
+///////////////////////////// Réglage automatique (--autotune)
+
+static tuning_param_t scrollup_params [] = {
+  { "chunk", &omp_d_chunk, "omp_d", 1, 256, 0, NULL },
+  { NULL }
+};
+
+tuning_kernel_t scrollup_tuning = { scrollup_params, NULL };
+
+
+///////////////////////////// Registre des versions
+
+static version_desc_t scrollup_versions [] = {
+  { "seq",   scrollup_compute_seq,   NULL, NULL, NULL, VERSION_DOUBLE_BUFFER | VERSION_SEQUENTIAL },
+  { "omp",   scrollup_compute_omp,   NULL, NULL, scrollup_ft_omp,   VERSION_DOUBLE_BUFFER },
+  { "omp_d", scrollup_compute_omp_d, NULL, NULL, scrollup_ft_omp_d, VERSION_DOUBLE_BUFFER },
+  { NULL }
+};
+
+static kernel_desc_t scrollup_kernel = { "scrollup", scrollup_versions, NULL, &scrollup_tuning };
+
+REGISTER_KERNEL (scrollup_kernel)
@@ -0,0 +1,547 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "constants.h"
+#include "global.h"
+#include "compute.h"
+#include "error.h"
+#include "debug.h"
+#include "hash.h"
+#include "histogram.h"
+#include "timing.h"
+#include "serve.h"
+
+#define CONN_QUEUE   256  // connexions acceptées en attente d'un thread
+#define HASH_BUCKETS 4096
+#define REQUEST_MAX  2048
+#define RECV_TIMEOUT 5    // s, pour qu'un client muet ne bloque pas un thread
+
+char *serve_address = NULL;
+
+struct tile_key {
+  uint64_t x, y;
+  unsigned zoom, size;
+};
+
+struct tile {
+  struct tile_key key;
+  struct tile *hash_next;
+  struct tile *prev, *next; // liste LRU, la plus récente en tête
+  int ready;
+  unsigned refs;            // réponses en attente du calcul ou en cours d'envoi
+  size_t len;
+  char *data;               // image PPM complète
+};
+
+// Cache et statistiques, protégés par lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rendered = PTHREAD_COND_INITIALIZER;
+static struct tile *buckets [HASH_BUCKETS];
+static struct tile *lru_head = NULL, *lru_tail = NULL;
+static size_t cache_bytes = 0, cache_budget = 256UL << 20;
+static unsigned long cache_entries = 0;
+static unsigned long hits = 0, coalesced = 0, misses = 0, errors = 0;
+static histogram_t latency;
+
+// File des connexions acceptées
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int queue [CONN_QUEUE];
+static unsigned queue_head = 0, queue_len = 0;
+static int quit = 0;
+
+static volatile sig_atomic_t stop = 0;
+static int unix_socket = 0;
+
+static void on_signal (int sig)
+{
+  stop = 1;
+}
+
+///////////////////////////// Cache LRU
+
+static unsigned key_bucket (struct tile_key *k)
+{
+  uint64_t h = HASH_INIT;
+
+  h = hash_bytes (h, &k->x, sizeof (k->x));
+  h = hash_bytes (h, &k->y, sizeof (k->y));
+  h = hash_bytes (h, &k->zoom, sizeof (k->zoom));
+  h = hash_bytes (h, &k->size, sizeof (k->size));
+
+  return h % HASH_BUCKETS;
+}
+
+static int key_equal (struct tile_key *a, struct tile_key *b)
+{
+  return a->x == b->x && a->y == b->y && a->zoom == b->zoom && a->size == b->size;
+}
+
+static void lru_unlink (struct tile *t)
+{
+  if (t->prev != NULL)
+    t->prev->next = t->next;
+  else
+    lru_head = t->next;
+
+  if (t->next != NULL)
+    t->next->prev = t->prev;
+  else
+    lru_tail = t->prev;
+}
+
+static void lru_push (struct tile *t)
+{
+  t->prev = NULL;
+  t->next = lru_head;
+  if (lru_head != NULL)
+    lru_head->prev = t;
+  lru_head = t;
+  if (lru_tail == NULL)
+    lru_tail = t;
+}
+
+static void cache_remove (struct tile *t)
+{
+  struct tile **p = &buckets [key_bucket (&t->key)];
+
+  while (*p != t)
+    p = &(*p)->hash_next;
+  *p = t->hash_next;
+
+  lru_unlink (t);
+
+  cache_bytes -= t->len;
+  cache_entries--;
+  free (t->data);
+  free (t);
+}
+
+// Libère les tuiles les moins récemment servies, sauf celles en cours de
+// calcul, attendues ou en cours d'envoi (refs > 0)
+static void cache_evict (void)
+{
+  struct tile *t = lru_tail;
+
+  while (cache_bytes > cache_budget && t != NULL) {
+    struct tile *prev = t->prev;
+
+    if (t->ready && t->refs == 0)
+      cache_remove (t);
+    t = prev;
+  }
+}
+
+static void render (struct tile *t)
+{
+  unsigned s = t->key.size;
+  unsigned *pixels = malloc ((size_t) s * s * sizeof (unsigned));
+  int header;
+  char *p;
+
+  the_tile (pixels, s, t->key.y * s, t->key.x * s, s, s, (unsigned long) s << t->key.zoom);
+
+  t->data = malloc (32 + (size_t) s * s * 3);
+  header = sprintf (t->data, "P6\n%u %u\n255\n", s, s);
+  p = t->data + header;
+
+  for (size_t i = 0; i < (size_t) s * s; i++) {
+    *p++ = pixels [i] >> 24;
+    *p++ = pixels [i] >> 16;
+    *p++ = pixels [i] >> 8;
+  }
+
+  t->len = p - t->data;
+  free (pixels);
+}
+
+// Renvoie la tuile, calculée si besoin, réservée jusqu'à cache_release ;
+// *how indique d'où elle vient
+static struct tile *cache_get (struct tile_key *k, const char **how)
+{
+  unsigned b = key_bucket (k);
+  struct tile *t;
+
+  pthread_mutex_lock (&lock);
+
+  for (t = buckets [b]; t != NULL; t = t->hash_next)
+    if (key_equal (&t->key, k))
+      break;
+
+  if (t != NULL) {
+    // Réservée avant toute attente : sinon le thread qui la calcule
+    // pourrait la libérer (cache_release, cache_evict) pendant qu'on dort
+    t->refs++;
+    if (t->ready) {
+      hits++;
+      *how = "hit";
+    } else {
+      // Même tuile en cours de calcul : on attend son résultat
+      coalesced++;
+      *how = "coalesced";
+      while (!t->ready)
+	pthread_cond_wait (&rendered, &lock);
+    }
+    lru_unlink (t);
+    lru_push (t);
+    pthread_mutex_unlock (&lock);
+    return t;
+  }
+
+  misses++;
+  *how = "miss";
+
+  t = calloc (1, sizeof (struct tile));
+  t->key = *k;
+  t->refs = 1;
+  t->hash_next = buckets [b];
+  buckets [b] = t;
+  lru_push (t);
+  cache_entries++;
+
+  pthread_mutex_unlock (&lock);
+
+  render (t);
+
+  pthread_mutex_lock (&lock);
+  t->ready = 1;
+  cache_bytes += t->len;
+  cache_evict ();
+  pthread_cond_broadcast (&rendered);
+  pthread_mutex_unlock (&lock);
+
+  return t;
+}
+
+static void cache_release (struct tile *t)
+{
+  pthread_mutex_lock (&lock);
+  t->refs--;
+  cache_evict ();
+  pthread_mutex_unlock (&lock);
+}
+
+///////////////////////////// HTTP
+
+static void write_all (int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send (fd, buf, len, MSG_NOSIGNAL);
+
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+	continue;
+      return; // client parti
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+static void reply (int fd, const char *status, const char *type, const char *cache,
+		   const char *body, size_t len)
+{
+  char header [256];
+  int n;
+
+  n = snprintf (header, sizeof (header),
+		"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+		"%s%s%sConnection: close\r\n\r\n",
+		status, type, len,
+		cache ? "X-Cache: " : "", cache ? cache : "", cache ? "\r\n" : "");
+
+  write_all (fd, header, n);
+  write_all (fd, body, len);
+}
+
+static void reply_error (int fd, const char *status, const char *msg)
+{
+  pthread_mutex_lock (&lock);
+  errors++;
+  pthread_mutex_unlock (&lock);
+
+  reply (fd, status, "text/plain", NULL, msg, strlen (msg));
+}
+
+// Appelé avec lock
+static void print_stats (FILE *f)
+{
+  unsigned long total = hits + coalesced + misses;
+
+  fprintf (f, "Tile server: %lu tile requests, hit rate %.1f%% (%lu hits, %lu coalesced, %lu misses), %lu errors\n",
+	   total, total ? 100.0 * (hits + coalesced) / total : 0.0,
+	   hits, coalesced, misses, errors);
+  fprintf (f, "Cache: %lu tiles, %.1f / %.1f MiB\n",
+	   cache_entries, cache_bytes / 1048576.0, cache_budget / 1048576.0);
+  histogram_print (&latency, "latency", f);
+}
+
+static void serve_stats (int fd)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream (&buf, &len);
+
+  pthread_mutex_lock (&lock);
+  print_stats (f);
+  pthread_mutex_unlock (&lock);
+  fclose (f);
+
+  reply (fd, "200 OK", "text/plain", NULL, buf, len);
+  free (buf);
+}
+
+// x=..&y=..&zoom=..&size=.. dans n'importe quel ordre ; tous obligatoires
+static int parse_tile (char *query, struct tile_key *k)
+{
+  unsigned seen = 0;
+  char *save;
+
+  for (char *tok = strtok_r (query, "&", &save); tok != NULL; tok = strtok_r (NULL, "&", &save)) {
+    char *eq = strchr (tok, '='), *end;
+    unsigned long long v;
+
+    if (eq == NULL)
+      return 0;
+    *eq = '\0';
+    v = strtoull (eq + 1, &end, 10);
+    if (eq [1] == '\0' || *end != '\0')
+      return 0;
+
+    if (!strcmp (tok, "x"))
+      k->x = v, seen |= 1;
+    else if (!strcmp (tok, "y"))
+      k->y = v, seen |= 2;
+    else if (!strcmp (tok, "zoom") && v <= SERVE_MAX_ZOOM)
+      k->zoom = v, seen |= 4;
+    else if (!strcmp (tok, "size") && v >= 1 && v <= SERVE_MAX_SIZE)
+      k->size = v, seen |= 8;
+    else
+      return 0;
+  }
+
+  return seen == 15 && k->x < (1ULL << k->zoom) && k->y < (1ULL << k->zoom);
+}
+
+static void handle (int fd)
+{
+  char req [REQUEST_MAX], *path, *end;
+  size_t len = 0;
+  uint64_t start;
+
+  // La première ligne suffit : "GET <chemin> HTTP/1.x"
+  while (len < sizeof (req) - 1) {
+    ssize_t n = recv (fd, req + len, sizeof (req) - 1 - len, 0);
+
+    if (n <= 0)
+      break;
+    len += n;
+    req [len] = '\0';
+    if (strchr (req, '\n') != NULL)
+      break;
+  }
+  req [len] = '\0';
+
+  start = timing_stamp ();
+
+  if (strncmp (req, "GET ", 4)) {
+    reply_error (fd, "405 Method Not Allowed", "Only GET is supported\n");
+    return;
+  }
+
+  path = req + 4;
+  end = strpbrk (path, " \r\n");
+  if (end != NULL)
+    *end = '\0';
+
+  if (!strcmp (path, "/stats"))
+    serve_stats (fd);
+  else if (!strncmp (path, "/tile?", 6)) {
+    struct tile_key k = { 0 };
+    struct tile *t;
+    const char *how;
+
+    if (!parse_tile (path + 6, &k)) {
+      reply_error (fd, "400 Bad Request",
+		   "Expected /tile?x=<x>&y=<y>&zoom=<z>&size=<s> with x, y < 2^z\n");
+      return;
+    }
+
+    t = cache_get (&k, &how);
+    reply (fd, "200 OK", "image/x-portable-pixmap", how, t->data, t->len);
+    cache_release (t);
+
+    pthread_mutex_lock (&lock);
+    histogram_record (&latency, timing_ns (start, timing_stamp ()));
+    pthread_mutex_unlock (&lock);
+  } else
+    reply_error (fd, "404 Not Found", "Try /tile?x=0&y=0&zoom=0&size=256 or /stats\n");
+}
+
+///////////////////////////// Groupe de threads
+
+static void *worker (void *arg)
+{
+  for (;;) {
+    int fd;
+
+    pthread_mutex_lock (&queue_lock);
+    while (queue_len == 0 && !quit)
+      pthread_cond_wait (&queue_cond, &queue_lock);
+    if (queue_len == 0) {
+      pthread_mutex_unlock (&queue_lock);
+      return NULL;
+    }
+    fd = queue [queue_head];
+    queue_head = (queue_head + 1) % CONN_QUEUE;
+    queue_len--;
+    pthread_cond_broadcast (&queue_cond);
+    pthread_mutex_unlock (&queue_lock);
+
+    handle (fd);
+    close (fd);
+  }
+}
+
+static void enqueue (int fd)
+{
+  pthread_mutex_lock (&queue_lock);
+  while (queue_len == CONN_QUEUE)
+    pthread_cond_wait (&queue_cond, &queue_lock);
+  queue [(queue_head + queue_len) % CONN_QUEUE] = fd;
+  queue_len++;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+// Nombre : port TCP sur 127.0.0.1 ; sinon, chemin d'une socket Unix
+static int open_listener (char *address)
+{
+  char *end;
+  long port = strtol (address, &end, 10);
+  int fd;
+
+  if (*address != '\0' && *end == '\0') {
+    struct sockaddr_in sa = { 0 };
+    int one = 1;
+
+    if (port <= 0 || port > 65535)
+      exit_with_error ("Invalid port number %s\n", address);
+
+    fd = socket (AF_INET, SOCK_STREAM, 0);
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons (port);
+    sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+      exit_with_error ("Cannot bind 127.0.0.1:%ld (%s)\n", port, strerror (errno));
+
+    printf ("Serving tiles on http://127.0.0.1:%ld/\n", port);
+  } else {
+    struct sockaddr_un sa = { 0 };
+
+    if (strlen (address) >= sizeof (sa.sun_path))
+      exit_with_error ("Socket path too long: %s\n", address);
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    sa.sun_family = AF_UNIX;
+    strcpy (sa.sun_path, address);
+    unlink (address);
+
+    if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+      exit_with_error ("Cannot bind %s (%s)\n", address, strerror (errno));
+
+    unix_socket = 1;
+    printf ("Serving tiles on Unix socket %s\n", address);
+  }
+
+  if (listen (fd, 64) < 0)
+    exit_with_error ("listen failed (%s)\n", strerror (errno));
+
+  return fd;
+}
+
+void serve_run (char *address)
+{
+  unsigned nb_workers = sysconf (_SC_NPROCESSORS_ONLN);
+  struct sigaction sa = { 0 };
+  pthread_t *tids;
+  char *str;
+  int lfd;
+
+  if (the_tile == NULL)
+    exit_with_error ("Current kernel has no tile function: tile server unavailable\n");
+
+  str = getenv ("SERVE_WORKERS");
+  if (str != NULL)
+    nb_workers = atoi (str);
+  if (nb_workers == 0)
+    nb_workers = 1;
+
+  str = getenv ("SERVE_CACHE_MB");
+  if (str != NULL)
+    cache_budget = (size_t) atol (str) << 20;
+
+  timing_init ();
+  histogram_reset (&latency);
+
+  lfd = open_listener (address);
+
+  // Sans SA_RESTART : accept est interrompu par le signal
+  sa.sa_handler = on_signal;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  printf ("%u workers, cache of %zu MiB, Ctrl-C to stop\n", nb_workers, cache_budget >> 20);
+  fflush (stdout);
+
+  tids = malloc (nb_workers * sizeof (pthread_t));
+  for (unsigned w = 0; w < nb_workers; w++)
+    pthread_create (&tids [w], NULL, worker, NULL);
+
+  while (!stop) {
+    struct timeval tv = { RECV_TIMEOUT, 0 };
+    int fd = accept (lfd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+	continue;
+      exit_with_error ("accept failed (%s)\n", strerror (errno));
+    }
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    enqueue (fd);
+  }
+
+  close (lfd);
+  if (unix_socket)
+    unlink (address);
+
+  // Les requêtes déjà acceptées sont servies avant l'arrêt
+  pthread_mutex_lock (&queue_lock);
+  quit = 1;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+
+  for (unsigned w = 0; w < nb_workers; w++)
+    pthread_join (tids [w], NULL);
+  free (tids);
+
+  printf ("\n");
+  print_stats (stdout);
+
+  while (lru_head != NULL)
+    cache_remove (lru_head);
+}
@@ -0,0 +1,38 @@
+
+#include <stdint.h>
+
+#include "debug.h"
+#include "timing.h"
+
+#ifdef TIMING_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+double timing_tsc_ns = 0.0;
+
+void timing_init (void)
+{
+#ifdef TIMING_HAVE_TSC
+  unsigned a, b, c, d;
+  double t0, t1;
+  uint64_t c0, c1;
+
+  // TSC invariant : fréquence constante, quels que soient le cœur et
+  // l'état d'énergie (CPUID 0x80000007, EDX bit 8)
+  if (!__get_cpuid (0x80000007, &a, &b, &c, &d) || !(d & (1 << 8))) {
+    PRINT_DEBUG ('t', "No invariant TSC, using clock_gettime\n");
+    return;
+  }
+
+  // Étalonnage sur ~20 ms de CLOCK_MONOTONIC
+  t0 = timing_now ();
+  c0 = __rdtsc ();
+  do
+    t1 = timing_now ();
+  while (t1 - t0 < 20.0);
+  c1 = __rdtsc ();
+
+  timing_tsc_ns = (t1 - t0) * 1e6 / (c1 - c0);
+  PRINT_DEBUG ('t', "Using rdtsc: %.3f GHz\n", 1.0 / timing_tsc_ns);
+#endif
+}
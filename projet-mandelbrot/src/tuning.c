@@ -0,0 +1,340 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "constants.h"
+#include "global.h"
+#include "compute.h"
+#include "debug.h"
+#include "error.h"
+#include "ocl.h"
+#include "tuning.h"
+#include "timing.h"
+
+#define DEFAULT_PROFILE      "tuning.profile"
+#define MAX_PARAMS           16
+#define MAX_CANDIDATES       32
+#define MAX_ROUNDS           3
+
+// Arrêt anticipé des mesures d'un candidat : au moins MIN_SAMPLES
+// échantillons, au plus MAX_SAMPLES ; on s'arrête dès que l'intervalle
+// de confiance à 95 % de la moyenne est à PRECISION près, ou dès qu'il
+// est entièrement au-dessus du meilleur temps connu
+#define MIN_SAMPLES          3
+#define MAX_SAMPLES          20
+#define PRECISION            0.01
+
+tuning_kernel_t *the_tuning = NULL;
+unsigned do_autotune = 0;
+
+// Taille des groupes de travail : commune à toutes les versions OpenCL
+static int valid_tilex (unsigned v);
+static int valid_tiley (unsigned v);
+
+static tuning_param_t ocl_params [] = {
+  { "tilex", &TILEX, NULL, 1, 64, TUNE_DIVIDES_DIM | TUNE_OCL_REBUILD, valid_tilex },
+  { "tiley", &TILEY, NULL, 1, 64, TUNE_DIVIDES_DIM | TUNE_OCL_REBUILD, valid_tiley },
+  { NULL }
+};
+
+static int valid_tilex (unsigned v)
+{
+  return v * TILEY <= ocl_max_workgroup_size ();
+}
+
+static int valid_tiley (unsigned v)
+{
+  return TILEX * v <= ocl_max_workgroup_size ();
+}
+
+static tuning_param_t *active [MAX_PARAMS];
+static unsigned nb_active = 0;
+
+static int version_listed (const char *list)
+{
+  size_t len = strlen (version);
+
+  if (list == NULL)
+    return 1;
+
+  for (const char *p = list; *p; p += strcspn (p, ",")) {
+    if (*p == ',')
+      p++;
+    if (!strncmp (p, version, len) && (p [len] == ',' || p [len] == '\0'))
+      return 1;
+  }
+  return 0;
+}
+
+static void add_params (tuning_param_t *params)
+{
+  for (tuning_param_t *p = params; p != NULL && p->name != NULL; p++)
+    if (nb_active < MAX_PARAMS && version_listed (p->versions))
+      active [nb_active++] = p;
+}
+
+static void find_params (void)
+{
+  nb_active = 0;
+
+  if (the_tuning != NULL)
+    add_params (the_tuning->params);
+
+  if (opencl_used)
+    add_params (ocl_params);
+}
+
+static char *profile_name (void)
+{
+  char *str = getenv ("TUNING_PROFILE");
+
+  return str != NULL ? str : DEFAULT_PROFILE;
+}
+
+// Début de ligne du profil : machine, noyau, version, DIM, threads
+static void profile_key (char *buf, size_t len, const char *kernel)
+{
+  char host [256];
+
+  if (gethostname (host, sizeof (host)) < 0)
+    strcpy (host, "unknown");
+  host [sizeof (host) - 1] = '\0';
+
+  snprintf (buf, len, "%s %s %s %u %d", host, kernel, version, DIM,
+	    omp_get_max_threads ());
+}
+
+static void print_config (FILE *f)
+{
+  for (unsigned i = 0; i < nb_active; i++)
+    fprintf (f, " %s=%u", active [i]->name, *active [i]->value);
+}
+
+void tuning_load_profile (const char *kernel)
+{
+  char key [1024], line [4096], best [4096] = "";
+  size_t key_len;
+  FILE *f;
+
+  find_params ();
+  if (nb_active == 0)
+    return;
+
+  f = fopen (profile_name (), "r");
+  if (f == NULL)
+    return;
+
+  profile_key (key, sizeof (key), kernel);
+  key_len = strlen (key);
+
+  // La dernière ligne qui correspond l'emporte
+  while (fgets (line, sizeof (line), f) != NULL)
+    if (line [0] != '#' && !strncmp (line, key, key_len) && line [key_len] == ' ')
+      strcpy (best, line + key_len);
+
+  fclose (f);
+
+  if (best [0] == '\0')
+    return;
+
+  for (char *tok = strtok (best, " \t\n"); tok != NULL; tok = strtok (NULL, " \t\n")) {
+    char *eq = strchr (tok, '=');
+
+    if (eq == NULL)
+      continue;
+    *eq = '\0';
+    for (unsigned i = 0; i < nb_active; i++)
+      if (!strcmp (active [i]->name, tok))
+	*active [i]->value = atoi (eq + 1);
+  }
+
+  printf ("Using tuning profile %s:", profile_name ());
+  print_config (stdout);
+  printf ("\n");
+}
+
+static void save_profile (const char *kernel)
+{
+  char key [1024];
+  FILE *f = fopen (profile_name (), "a");
+
+  if (f == NULL) {
+    perror (profile_name ());
+    return;
+  }
+
+  profile_key (key, sizeof (key), kernel);
+  fprintf (f, "%s", key);
+  print_config (f);
+  fprintf (f, "\n");
+  fclose (f);
+
+  printf ("Configuration saved to %s\n", profile_name ());
+}
+
+static unsigned candidates (tuning_param_t *p, unsigned *cand)
+{
+  unsigned n = 0;
+
+  // Diviseurs de DIM dans [min, max], ou puissances de deux sinon
+  for (unsigned v = p->min; v <= p->max && n < MAX_CANDIDATES;
+       v = (p->flags & TUNE_DIVIDES_DIM) ? v + 1 : v * 2) {
+    if ((p->flags & TUNE_DIVIDES_DIM) && DIM % v)
+      continue;
+    if (p->valid != NULL && !p->valid (v))
+      continue;
+    cand [n++] = v;
+  }
+
+  return n;
+}
+
+static void apply (tuning_param_t *p, unsigned v)
+{
+  if (*p->value == v)
+    return;
+
+  *p->value = v;
+  if (p->flags & TUNE_OCL_REBUILD)
+    ocl_rebuild_program ();
+}
+
+// Durée (ms) d'un appel à the_compute depuis l'état initial du noyau
+static double run_once (void)
+{
+  double t;
+
+  if (the_tuning != NULL && the_tuning->rewind != NULL)
+    the_tuning->rewind ();
+
+  t = timing_now ();
+  the_compute (refresh_rate);
+  if (opencl_used)
+    ocl_wait ();
+
+  return timing_now () - t;
+}
+
+// Quantiles de Student à 97,5 % pour 1 à 10 degrés de liberté
+static double student (unsigned df)
+{
+  static const double t [] = { 12.71, 4.30, 3.18, 2.78, 2.57,
+			       2.45, 2.36, 2.31, 2.26, 2.23 };
+
+  return df <= 10 ? t [df - 1] : 2.0;
+}
+
+static double measure (double best, unsigned *samples)
+{
+  double sum = 0.0, sum2 = 0.0, mean = 0.0;
+  unsigned n;
+
+  // Échauffement : pages, caches, threads, compilation paresseuse
+  run_once ();
+
+  for (n = 1; n <= MAX_SAMPLES; n++) {
+    double t = run_once ();
+
+    sum += t;
+    sum2 += t * t;
+    mean = sum / n;
+
+    if (n >= MIN_SAMPLES) {
+      double var = (sum2 - n * mean * mean) / (n - 1);
+      double half2 = student (n - 1) * student (n - 1) * (var > 0 ? var : 0) / n;
+
+      // Clairement plus lent que le meilleur candidat
+      if (mean > best && (mean - best) * (mean - best) > half2)
+	break;
+      // Moyenne connue à PRECISION près
+      if (half2 < PRECISION * PRECISION * mean * mean)
+	break;
+    }
+  }
+
+  *samples = MIN (n, MAX_SAMPLES);
+  return mean;
+}
+
+// Recherche par coordonnées : chaque paramètre est balayé à son tour, les
+// autres étant fixés à leur meilleure valeur, jusqu'à stabilisation
+void tuning_autotune (const char *kernel)
+{
+  double best = 1e300;
+  unsigned samples;
+  int changed = 1;
+
+  find_params ();
+  if (nb_active == 0)
+    exit_with_error ("Kernel %s, version %s has no tunable parameter\n", kernel, version);
+
+  printf ("Autotuning %s/%s (DIM %u, %d threads, %u frames per sample)\n",
+	  kernel, version, DIM, omp_get_max_threads (), refresh_rate);
+
+  // Une valeur initiale hors des candidats (ex : grain ne divisant pas
+  // DIM) fausserait la référence : on part du candidat le plus proche
+  for (unsigned i = 0; i < nb_active; i++) {
+    tuning_param_t *p = active [i];
+    unsigned cand [MAX_CANDIDATES];
+    unsigned nc = candidates (p, cand);
+    unsigned closest = *p->value;
+
+    for (unsigned c = 0; c < nc; c++)
+      if (c == 0 || abs ((int) cand [c] - (int) *p->value) < abs ((int) closest - (int) *p->value))
+	closest = cand [c];
+
+    if (nc == 0)
+      exit_with_error ("No valid value for parameter %s with DIM %u\n", p->name, DIM);
+    if (closest != *p->value) {
+      printf ("%s=%u is not valid here, starting from %s=%u\n",
+	      p->name, *p->value, p->name, closest);
+      apply (p, closest);
+    }
+  }
+
+  best = measure (best, &samples);
+  printf ("Initial configuration:");
+  print_config (stdout);
+  printf (" : %.3f ms\n", best);
+
+  for (unsigned round = 0; round < MAX_ROUNDS && changed; round++) {
+    changed = 0;
+
+    for (unsigned i = 0; i < nb_active; i++) {
+      tuning_param_t *p = active [i];
+      unsigned cand [MAX_CANDIDATES];
+      unsigned nc = candidates (p, cand);
+      unsigned best_value = *p->value;
+
+      for (unsigned c = 0; c < nc; c++) {
+	double t;
+
+	if (cand [c] == best_value)
+	  continue;
+
+	apply (p, cand [c]);
+	t = measure (best, &samples);
+
+	printf ("  %s=%-4u : %10.3f ms (%u samples)%s\n", p->name, cand [c], t, samples,
+		t < best ? " *" : "");
+
+	if (t < best) {
+	  best = t;
+	  best_value = cand [c];
+	  changed = 1;
+	}
+      }
+
+      apply (p, best_value);
+    }
+  }
+
+  printf ("Best configuration:");
+  print_config (stdout);
+  printf (" : %.3f ms\n", best);
+
+  save_profile (kernel);
+}
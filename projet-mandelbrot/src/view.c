@@ -0,0 +1,232 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <SDL.h>
+
+#include "constants.h"
+#include "global.h"
+#include "graphics.h"
+#include "compute.h"
+#include "error.h"
+#include "overlay.h"
+#include "latency.h"
+#include "timing.h"
+#include "view.h"
+
+#define ZOOM_STEP  1.25 // par cran de molette
+#define REFRESH_MS 16   // affichage pendant le calcul
+
+unsigned do_interactive = 0;
+unsigned view_generation = 0;
+unsigned view_frame_generation = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+// Protégés par lock
+static double pending_u, pending_v, pending_k;
+static int has_pending = 0;
+static uint64_t pending_stamp;   // première demande non encore appliquée
+static int frame_done = 0;
+static int quit = 0;
+
+static navigate_func_t the_navigate = NULL;
+static Uint32 *preview_buf = NULL;
+
+// Mis à jour par le thread de calcul, lus par l'affichage
+static unsigned published = 0;    // aperçus et images complètes produits
+static unsigned busy = 0;
+static uint64_t preview_stamp = 0; // demande dont l'aperçu est prêt
+
+void view_request (double u, double v, double k)
+{
+  pthread_mutex_lock (&lock);
+
+  if (!has_pending) {
+    pending_u = pending_v = 0.0;
+    pending_k = 1.0;
+    pending_stamp = timing_stamp ();
+    has_pending = 1;
+  }
+
+  // Composition avec la demande non encore appliquée
+  pending_u += u * pending_k;
+  pending_v += v * pending_k;
+  pending_k *= k;
+
+  __atomic_add_fetch (&view_generation, 1, __ATOMIC_RELEASE);
+  pthread_cond_signal (&wakeup);
+
+  pthread_mutex_unlock (&lock);
+}
+
+// Aperçu : the_tile sur une image VIEW_PREVIEW fois plus petite, agrandie
+static void preview (void)
+{
+  unsigned d = DIM / VIEW_PREVIEW;
+
+  if (the_tile == NULL || d == 0)
+    return;
+
+  #pragma omp parallel for schedule(dynamic)
+  for (unsigned r = 0; r < d; r++)
+    the_tile (preview_buf + (size_t) r * d, d, r, 0, 1, d, d);
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < DIM; i++)
+    for (int j = 0; j < DIM; j++)
+      cur_img (i, j) = preview_buf [(size_t) MIN (i / VIEW_PREVIEW, d - 1) * d
+				    + MIN (j / VIEW_PREVIEW, d - 1)];
+}
+
+static void *compute_thread (void *arg)
+{
+  for (;;) {
+    double u = 0.0, v = 0.0, k = 1.0;
+    uint64_t stamp = 0;
+    unsigned gen;
+
+    pthread_mutex_lock (&lock);
+    while (!quit && !has_pending && frame_done)
+      pthread_cond_wait (&wakeup, &lock);
+
+    if (quit) {
+      pthread_mutex_unlock (&lock);
+      break;
+    }
+
+    if (has_pending) {
+      u = pending_u; v = pending_v; k = pending_k;
+      stamp = pending_stamp;
+      has_pending = 0;
+    }
+
+    gen = view_generation;
+    view_frame_generation = gen;
+    frame_done = 0;
+    __atomic_store_n (&busy, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&lock);
+
+    if (stamp != 0) {
+      the_navigate (u, v, k);
+      preview ();
+      __atomic_store_n (&preview_stamp, stamp, __ATOMIC_RELEASE);
+      __atomic_add_fetch (&published, 1, __ATOMIC_RELEASE);
+    }
+
+    {
+      uint64_t s = timing_stamp ();
+
+      the_compute (1);
+      if (latency_enabled && !view_cancelled ())
+	latency_record (PHASE_COMPUTE, timing_ns (s, timing_stamp ()));
+    }
+
+    pthread_mutex_lock (&lock);
+    // Image complète si aucune demande n'est arrivée entre temps
+    if (view_generation == gen)
+      frame_done = 1;
+    __atomic_store_n (&busy, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&published, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock (&lock);
+  }
+
+  return NULL;
+}
+
+static void stop_compute_thread (pthread_t tid)
+{
+  pthread_mutex_lock (&lock);
+  quit = 1;
+  // Annule l'image en cours
+  __atomic_add_fetch (&view_generation, 1, __ATOMIC_RELEASE);
+  pthread_cond_signal (&wakeup);
+  pthread_mutex_unlock (&lock);
+
+  pthread_join (tid, NULL);
+}
+
+void view_interactive (navigate_func_t navigate)
+{
+  unsigned shown = 0;
+  int dragging = 0;
+  pthread_t tid;
+
+  if (navigate == NULL || opencl_used || !graphics_display_enabled ())
+    exit_with_error ("Interactive mode needs a display and a CPU version of a kernel "
+		     "that supports navigation\n");
+
+  the_navigate = navigate;
+  preview_buf = malloc ((size_t) (DIM / VIEW_PREVIEW + 1) * (DIM / VIEW_PREVIEW + 1) * sizeof (Uint32));
+
+  printf ("Interactive mode: mouse wheel to zoom, left button to drag, ESC to quit\n");
+
+  // Première demande vide : fige le cadre initial (plus de zoom automatique)
+  view_request (0.0, 0.0, 1.0);
+
+  if (pthread_create (&tid, NULL, compute_thread, NULL) != 0)
+    exit_with_error ("Cannot create compute thread\n");
+
+  for (int stop = 0; !stop;) {
+    SDL_Event evt;
+
+    if (SDL_WaitEventTimeout (&evt, REFRESH_MS))
+      do {
+	switch (evt.type) {
+	case SDL_QUIT:
+	  stop = 1;
+	  break;
+	case SDL_KEYDOWN:
+	  if (evt.key.keysym.sym == SDLK_ESCAPE)
+	    stop = 1;
+	  else if (evt.key.keysym.sym == SDLK_o)
+	    overlay_next_mode ();
+	  break;
+	case SDL_MOUSEWHEEL: {
+	  int mx, my;
+	  double k = pow (ZOOM_STEP, -evt.wheel.y);
+	  double ux, uy;
+
+	  // Le point sous le pointeur reste en place
+	  SDL_GetMouseState (&mx, &my);
+	  ux = (double) mx / WIN_WIDTH;
+	  uy = (double) my / WIN_HEIGHT;
+	  view_request (ux * (1.0 - k), uy * (1.0 - k), k);
+	  break;
+	}
+	case SDL_MOUSEBUTTONDOWN:
+	  dragging |= (evt.button.button == SDL_BUTTON_LEFT);
+	  break;
+	case SDL_MOUSEBUTTONUP:
+	  if (evt.button.button == SDL_BUTTON_LEFT)
+	    dragging = 0;
+	  break;
+	case SDL_MOUSEMOTION:
+	  if (dragging && (evt.motion.xrel || evt.motion.yrel))
+	    view_request (- (double) evt.motion.xrel / WIN_WIDTH,
+			  - (double) evt.motion.yrel / WIN_HEIGHT, 1.0);
+	  break;
+	default: ;
+	}
+      } while (SDL_PollEvent (&evt));
+
+    // L'image change sous nos yeux pendant le calcul : tout est renvoyé
+    if (__atomic_load_n (&busy, __ATOMIC_RELAXED)
+	|| __atomic_load_n (&published, __ATOMIC_ACQUIRE) != shown) {
+      uint64_t stamp = __atomic_exchange_n (&preview_stamp, 0, __ATOMIC_ACQUIRE);
+
+      shown = __atomic_load_n (&published, __ATOMIC_ACQUIRE);
+      graphics_mark_all_dirty ();
+      graphics_refresh ();
+
+      if (latency_enabled && stamp != 0)
+	latency_record (PHASE_INPUT, timing_ns (stamp, timing_stamp ()));
+    }
+  }
+
+  stop_compute_thread (tid);
+  free (preview_buf);
+}